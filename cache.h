@@ -0,0 +1,19 @@
+// cache.h
+// Alinhamento a linha de cache compartilhado pelos exercícios: estruturas escritas por threads
+// diferentes (travas, contadores, heartbeats) ficam cada uma na sua linha e não sofrem false sharing.
+// Objetos alocados no heap com CACHE_ALIGN precisam de _aligned_malloc(..., CACHE_LINE).
+//
+// Só cabeçalho, como rng.h.
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#define CACHE_LINE 64
+
+#ifdef _MSC_VER
+  #define CACHE_ALIGN __declspec(align(64))
+#else
+  #define CACHE_ALIGN __attribute__((aligned(64)))
+#endif
+
+#endif
@@ -3,17 +3,36 @@
 // aposta do usuário; atualização do placar com exclusão mútua;
 // empates resolvidos deterministicamente pelo menor índice (ID).
 //
+// Modo --fibras: cada cavalo é uma fibra (Win32 fibers) multiplexada sobre
+// poucas worker threads (M:N), com sleep cooperativo via timer wheel e
+// mutex/condvar cientes de fibras. Permite corridas com 100k cavalos e
+// reporta memória por cavalo e custo de troca de contexto vs threads do SO.
+//
+// Modo --lote: simulação de odds com R corridas simultâneas sobre um pool fixo de
+// threads de cavalo reusadas entre corridas; imprime taxa de vitória e distribuição
+// de colocação por cavalo e compara corridas/s com criar threads novas a cada corrida.
+//
 // Compilar: cl ex1_corrida.c  OR  gcc -o ex1_corrida.exe ex1_corrida.c
+// Uso: ex1_corrida.exe                      (interativo, threads do SO)
+//      ex1_corrida.exe --fibras [H] [W]     (H cavalos em W worker threads)
+//      ex1_corrida.exe --lote [R] [H] [N]   (N corridas, R simultâneas, H cavalos)
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
 #endif
+#ifndef PSAPI_VERSION
+  #define PSAPI_VERSION 2       /* GetProcessMemoryInfo -> K32GetProcessMemoryInfo (kernel32) */
+#endif
 #include <windows.h>
+#include <psapi.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <malloc.h>
+#include "rng.h"
+#include "cache.h"
 
 #define MAX_HORSES 10
 #define FINISH 100
@@ -22,16 +41,32 @@ typedef struct {
     int id;
     int pos;
     int finished;
+    Rng rng;        // passos e pausas do cavalo (fluxo = id, reproduzível com SEMENTE)
 } Horse;
 
-Horse horses[MAX_HORSES];
+Horse *horses;
 int H = 5;
 CRITICAL_SECTION cs;
 CONDITION_VARIABLE cv_start;
 int start_flag = 0;
-int finish_order[MAX_HORSES];
+int *finish_order;
 int finish_count = 0;
 
+// Avança um passo; chamar com o placar travado. Retorna 1 se cruzou a linha.
+static int horse_advance(Horse* h){
+    if (!h->finished) {
+        int step = 1 + rng_below(&h->rng, 10);
+        h->pos += step;
+        if (h->pos >= FINISH) {
+            h->pos = FINISH;
+            h->finished = 1;
+            // registra finish de forma determinística: menor id primeiro se vários chegarem logo
+            finish_order[finish_count++] = h->id;
+        }
+    }
+    return h->finished;
+}
+
 DWORD WINAPI horse_thread(LPVOID arg){
     Horse* h = (Horse*)arg;
     // Espera largada sincronizada
@@ -41,26 +76,570 @@ DWORD WINAPI horse_thread(LPVOID arg){
 
     // Avança em passos aleatórios até cruzar a linha
     while (1) {
-        Sleep(50 + rand()%150);
+        Sleep(50 + rng_below(&h->rng, 150));
         EnterCriticalSection(&cs);
-        if (!h->finished) {
-            int step = 1 + rand()%10;
-            h->pos += step;
-            if (h->pos >= FINISH) {
-                h->pos = FINISH;
-                h->finished = 1;
-                // registra finish de forma determinística: menor id primeiro se vários chegarem logo
-                finish_order[finish_count++] = h->id;
-            }
-        }
+        int done = horse_advance(h);
         LeaveCriticalSection(&cs);
-        if (h->finished) break;
+        if (done) break;
+    }
+    return 0;
+}
+
+static double now_ms() {
+    static LARGE_INTEGER freq;
+    static int inited = 0;
+    if (!inited) { QueryPerformanceFrequency(&freq); inited = 1; }
+    LARGE_INTEGER t; QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+static SIZE_T private_bytes() {
+    PROCESS_MEMORY_COUNTERS_EX pmc;
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) return 0;
+    return pmc.PrivateUsage;
+}
+
+/* ---------------------------------------------------------------------------
+ * Runtime M:N de fibras
+ *
+ * Cada worker thread converte-se em fibra e roda um laço de escalonamento que
+ * retira fibras prontas de uma fila global. Uma fibra que bloqueia (sleep,
+ * mutex, condvar) registra uma ação "after" e volta para a fibra escalonadora;
+ * a ação só é executada depois da troca, de modo que outra worker nunca retome
+ * uma fibra que ainda está saindo da CPU.
+ * ------------------------------------------------------------------------- */
+#define FIBER_STACK (64*1024)   // reserva de pilha por fibra
+#define WHEEL_SLOTS 256         // timer wheel com tick de 1 ms
+#define MAX_WORKERS MAXIMUM_WAIT_OBJECTS
+
+typedef struct Fiber {
+    LPVOID ctx;                 // retornado por CreateFiberEx
+    void (*fn)(void*);
+    void *arg;
+    ULONGLONG wake_tick;
+    struct Fiber *next;
+} Fiber;
+
+typedef struct { Fiber *head, *tail; } FiberList;
+
+typedef struct {
+    LPVOID sched;               // fibra escalonadora desta worker
+    Fiber *current;
+    void (*after)(void*);       // executada pelo escalonador após a troca
+    void *after_arg;
+} FiberWorker;
+
+static DWORD tls_worker = TLS_OUT_OF_INDEXES;
+static CRITICAL_SECTION sched_cs;   // protege runq e wheel
+static CONDITION_VARIABLE sched_cv;
+static FiberList runq;
+static FiberList wheel[WHEEL_SLOTS];
+static ULONGLONG wheel_tick;        // último tick já processado
+static volatile LONG live_fibers = 0;
+static volatile LONG64 dispatches = 0;
+
+static void fl_push(FiberList* l, Fiber* f){
+    f->next = NULL;
+    if (l->tail) l->tail->next = f; else l->head = f;
+    l->tail = f;
+}
+static Fiber* fl_pop(FiberList* l){
+    Fiber* f = l->head;
+    if (f) { l->head = f->next; if (!l->head) l->tail = NULL; }
+    return f;
+}
+
+static ULONGLONG now_tick() { return (ULONGLONG)now_ms(); }
+
+// Move para a fila de prontos as fibras cujo prazo venceu. Chamar com sched_cs.
+static void wheel_advance(ULONGLONG now){
+    if (now <= wheel_tick) return;
+    ULONGLONG steps = now - wheel_tick;
+    if (steps > WHEEL_SLOTS) steps = WHEEL_SLOTS;
+    for (ULONGLONG i=1;i<=steps;i++){
+        FiberList* slot = &wheel[(wheel_tick+i) % WHEEL_SLOTS];
+        Fiber* f = slot->head;
+        slot->head = slot->tail = NULL;
+        while (f) {
+            Fiber* next = f->next;
+            // prazos além de uma volta da roda permanecem no slot
+            fl_push(f->wake_tick <= now ? &runq : slot, f);
+            f = next;
+        }
+    }
+    wheel_tick = now;
+    if (runq.head) WakeAllConditionVariable(&sched_cv);
+}
+
+static void fiber_ready(Fiber* f){
+    EnterCriticalSection(&sched_cs);
+    fl_push(&runq, f);
+    WakeConditionVariable(&sched_cv);
+    LeaveCriticalSection(&sched_cs);
+}
+
+static void after_ready(void* p) { fiber_ready((Fiber*)p); }
+
+static void after_timer(void* p){
+    Fiber* f = (Fiber*)p;
+    EnterCriticalSection(&sched_cs);
+    if (f->wake_tick <= wheel_tick) fl_push(&runq, f);
+    else fl_push(&wheel[f->wake_tick % WHEEL_SLOTS], f);
+    LeaveCriticalSection(&sched_cs);
+}
+
+static void after_leave(void* p) { LeaveCriticalSection((CRITICAL_SECTION*)p); }
+
+static void after_exit(void* p){
+    Fiber* f = (Fiber*)p;
+    DeleteFiber(f->ctx);
+    free(f);
+    if (InterlockedDecrement(&live_fibers) == 0) {
+        EnterCriticalSection(&sched_cs);
+        WakeAllConditionVariable(&sched_cv);
+        LeaveCriticalSection(&sched_cs);
+    }
+}
+
+static FiberWorker* cur_worker() {
+    return tls_worker == TLS_OUT_OF_INDEXES ? NULL : (FiberWorker*)TlsGetValue(tls_worker);
+}
+
+// Suspende a fibra corrente; `after(arg)` roda na fibra escalonadora.
+static void fiber_park(void (*after)(void*), void* arg){
+    FiberWorker* w = cur_worker();
+    w->after = after; w->after_arg = arg;
+    SwitchToFiber(w->sched);
+}
+
+static void fiber_sleep(DWORD ms){
+    Fiber* f = cur_worker()->current;
+    f->wake_tick = now_tick() + ms;
+    fiber_park(after_timer, f);
+}
+
+static void WINAPI fiber_entry(LPVOID p){
+    Fiber* f = (Fiber*)p;
+    f->fn(f->arg);
+    fiber_park(after_exit, f);  // não retorna
+}
+
+static Fiber* fiber_spawn(void (*fn)(void*), void* arg){
+    Fiber* f = (Fiber*)calloc(1, sizeof(Fiber));
+    f->fn = fn; f->arg = arg;
+    f->ctx = CreateFiberEx(0, FIBER_STACK, 0, fiber_entry, f);
+    if (!f->ctx) { free(f); return NULL; }
+    InterlockedIncrement(&live_fibers);
+    fiber_ready(f);
+    return f;
+}
+
+DWORD WINAPI fiber_worker_thread(LPVOID arg){
+    (void)arg;
+    FiberWorker w = {0};
+    w.sched = ConvertThreadToFiber(NULL);
+    TlsSetValue(tls_worker, &w);
+    for (;;) {
+        EnterCriticalSection(&sched_cs);
+        wheel_advance(now_tick());
+        Fiber* f = fl_pop(&runq);
+        while (!f && live_fibers > 0) {
+            SleepConditionVariableCS(&sched_cv, &sched_cs, 1);
+            wheel_advance(now_tick());
+            f = fl_pop(&runq);
+        }
+        LeaveCriticalSection(&sched_cs);
+        if (!f) break;
+
+        w.current = f;
+        SwitchToFiber(f->ctx);
+        w.current = NULL;
+        InterlockedIncrement64(&dispatches);
+        if (w.after) { void (*fn)(void*) = w.after; w.after = NULL; fn(w.after_arg); }
+    }
+    ConvertFiberToThread();
+    return 0;
+}
+
+// Mutex ciente de fibras: quem espera é estacionado, não bloqueia a worker.
+typedef struct { CRITICAL_SECTION guard; int locked; FiberList waiters; } FMutex;
+// Condvar ciente de fibras (sempre usada com um FMutex).
+typedef struct { CRITICAL_SECTION guard; FiberList waiters; } FCond;
+
+static void fmutex_init(FMutex* m) { InitializeCriticalSection(&m->guard); m->locked = 0; m->waiters.head = m->waiters.tail = NULL; }
+static void fcond_init(FCond* c) { InitializeCriticalSection(&c->guard); c->waiters.head = c->waiters.tail = NULL; }
+
+static void fmutex_lock(FMutex* m){
+    EnterCriticalSection(&m->guard);
+    if (!m->locked) { m->locked = 1; LeaveCriticalSection(&m->guard); return; }
+    FiberWorker* w = cur_worker();
+    if (!w || !w->current) {
+        // chamador fora do runtime (thread principal): cede a CPU até conseguir
+        LeaveCriticalSection(&m->guard);
+        for (;;) {
+            SwitchToThread();
+            EnterCriticalSection(&m->guard);
+            if (!m->locked) { m->locked = 1; LeaveCriticalSection(&m->guard); return; }
+            LeaveCriticalSection(&m->guard);
+        }
+    }
+    fl_push(&m->waiters, w->current);
+    fiber_park(after_leave, &m->guard);   // posse transferida por fmutex_unlock
+}
+
+static void fmutex_unlock(FMutex* m){
+    EnterCriticalSection(&m->guard);
+    Fiber* f = fl_pop(&m->waiters);
+    if (!f) m->locked = 0;
+    LeaveCriticalSection(&m->guard);
+    if (f) fiber_ready(f);
+}
+
+static void fcond_wait(FCond* c, FMutex* m){
+    EnterCriticalSection(&c->guard);
+    fl_push(&c->waiters, cur_worker()->current);
+    fmutex_unlock(m);
+    fiber_park(after_leave, &c->guard);
+    fmutex_lock(m);
+}
+
+static void fcond_broadcast(FCond* c){
+    EnterCriticalSection(&c->guard);
+    Fiber* f = c->waiters.head;
+    c->waiters.head = c->waiters.tail = NULL;
+    LeaveCriticalSection(&c->guard);
+    while (f) { Fiber* next = f->next; fiber_ready(f); f = next; }
+}
+
+FMutex fcs;
+FCond fcv_start;
+volatile LONG at_gate = 0;
+
+static void horse_fiber(void* arg){
+    Horse* h = (Horse*)arg;
+    fmutex_lock(&fcs);
+    InterlockedIncrement(&at_gate);
+    while (!start_flag) fcond_wait(&fcv_start, &fcs);
+    fmutex_unlock(&fcs);
+
+    while (1) {
+        fiber_sleep(50 + rng_below(&h->rng, 150));
+        fmutex_lock(&fcs);
+        int done = horse_advance(h);
+        fmutex_unlock(&fcs);
+        if (done) break;
+    }
+}
+
+/* ---- Medições: troca de contexto fibra x thread, memória por cavalo ---- */
+#define SWITCH_ITERS 200000
+#define THREAD_PROBE 256
+
+static LPVOID bench_main_fiber;
+static void WINAPI bench_peer_fiber(LPVOID p){
+    (void)p;
+    for (;;) SwitchToFiber(bench_main_fiber);
+}
+
+static double fiber_switch_ns(){
+    bench_main_fiber = ConvertThreadToFiber(NULL);
+    LPVOID peer = CreateFiberEx(0, FIBER_STACK, 0, bench_peer_fiber, NULL);
+    double t0 = now_ms();
+    for (int i=0;i<SWITCH_ITERS;i++) SwitchToFiber(peer);
+    double t1 = now_ms();
+    DeleteFiber(peer);
+    ConvertFiberToThread();
+    return (t1 - t0) * 1e6 / (2.0 * SWITCH_ITERS);
+}
+
+static HANDLE ping_ev, pong_ev;
+DWORD WINAPI bench_pong_thread(LPVOID p){
+    (void)p;
+    for (int i=0;i<SWITCH_ITERS;i++) { WaitForSingleObject(ping_ev, INFINITE); SetEvent(pong_ev); }
+    return 0;
+}
+
+static double thread_switch_ns(){
+    ping_ev = CreateEvent(NULL, FALSE, FALSE, NULL);
+    pong_ev = CreateEvent(NULL, FALSE, FALSE, NULL);
+    HANDLE t = CreateThread(NULL,0,bench_pong_thread,NULL,0,NULL);
+    double t0 = now_ms();
+    for (int i=0;i<SWITCH_ITERS;i++) { SetEvent(ping_ev); WaitForSingleObject(pong_ev, INFINITE); }
+    double t1 = now_ms();
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t); CloseHandle(ping_ev); CloseHandle(pong_ev);
+    return (t1 - t0) * 1e6 / (2.0 * SWITCH_ITERS);
+}
+
+DWORD WINAPI idle_thread(LPVOID p) { (void)p; return 0; }
+
+// Memória privada comprometida por thread do SO (pilha padrão), amostrada com THREAD_PROBE threads suspensas.
+static double thread_bytes_each(){
+    HANDLE th[THREAD_PROBE];
+    SIZE_T before = private_bytes();
+    for (int i=0;i<THREAD_PROBE;i++) th[i] = CreateThread(NULL,0,idle_thread,NULL,CREATE_SUSPENDED,NULL);
+    SIZE_T after = private_bytes();
+    for (int i=0;i<THREAD_PROBE;i++) { ResumeThread(th[i]); WaitForSingleObject(th[i], INFINITE); CloseHandle(th[i]); }
+    return (double)(after - before) / THREAD_PROBE;
+}
+
+static int run_fiber_race(int argc, char** argv){
+    H = argc >= 3 ? atoi(argv[2]) : 100000;
+    if (H < 2) H = 2;
+    SYSTEM_INFO si; GetSystemInfo(&si);
+    int W = argc >= 4 ? atoi(argv[3]) : (int)si.dwNumberOfProcessors;
+    if (W < 1) W = 1;
+    if (W > MAX_WORKERS) W = MAX_WORKERS;
+
+    printf("Corrida com fibras: %d cavalos em %d worker threads\n", H, W);
+    double fsw = fiber_switch_ns();
+    double tsw = thread_switch_ns();
+    double tmem = thread_bytes_each();
+
+    horses = (Horse*)malloc(sizeof(Horse)*H);
+    finish_order = (int*)malloc(sizeof(int)*H);
+    InitializeCriticalSection(&sched_cs);
+    InitializeConditionVariable(&sched_cv);
+    fmutex_init(&fcs);
+    fcond_init(&fcv_start);
+    tls_worker = TlsAlloc();
+    wheel_tick = now_tick();
+
+    SIZE_T before = private_bytes();
+    for (int i=0;i<H;i++){
+        horses[i].id = i;
+        horses[i].pos = 0;
+        horses[i].finished = 0;
+        rng_seed(&horses[i].rng, rng_default_seed(), i);
+        finish_order[i] = -1;
+        if (!fiber_spawn(horse_fiber, &horses[i])) {
+            printf("CreateFiberEx falhou no cavalo %d; limitando a corrida a %d cavalos\n", i, i);
+            H = i;
+            break;
+        }
     }
+    SIZE_T after = private_bytes();
+
+    HANDLE th[MAX_WORKERS];
+    for (int i=0;i<W;i++) th[i] = CreateThread(NULL,0,fiber_worker_thread,NULL,0,NULL);
+
+    // largada sincronizada: todos os cavalos no portão antes de liberar
+    while (at_gate < H) Sleep(1);
+    fmutex_lock(&fcs);
+    start_flag = 1;
+    fcond_broadcast(&fcv_start);
+    fmutex_unlock(&fcs);
+    double t0 = now_ms();
+
+    WaitForMultipleObjects(W, th, TRUE, INFINITE);
+    double race_ms = now_ms() - t0;
+
+    int show = H < MAX_HORSES ? H : MAX_HORSES;
+    printf("Resultado (primeiros %d de %d):\n", show, finish_count);
+    for (int i=0;i<show;i++) printf("%d: Cavalo %d\n", i+1, finish_order[i]);
+    printf("Vencedor: Cavalo %d\n", finish_order[0]);
+
+    printf("\nCorrida: %.0f ms, %lld despachos de fibra (%.0f/s)\n",
+           race_ms, (long long)dispatches, dispatches / (race_ms / 1000.0));
+    printf("Memória por cavalo: fibra ~%.0f bytes (reserva de pilha %d KB) | thread do SO ~%.0f bytes\n",
+           H > 0 ? (double)(after - before) / H : 0.0, FIBER_STACK/1024, tmem);
+    printf("Troca de contexto: fibra %.1f ns | thread do SO (evento) %.1f ns\n", fsw, tsw);
+
+    for (int i=0;i<W;i++) CloseHandle(th[i]);
+    TlsFree(tls_worker);
+    DeleteCriticalSection(&sched_cs);
+    DeleteCriticalSection(&fcs.guard);
+    DeleteCriticalSection(&fcv_start.guard);
+    free(horses); free(finish_order);
     return 0;
 }
 
-int main(){
-    srand((unsigned)time(NULL));
+/* ---------------------------------------------------------------------------
+ * Modo em lote (simulação de odds)
+ *
+ * R corridas simultâneas sobre um pool fixo de H threads, uma por cavalo, reusadas
+ * em todas as corridas. O tempo é simulado: cada passo custa 50..199 ms de "relógio
+ * da corrida" (o mesmo sorteio do Sleep do modo interativo) e a chegada é ordenada por
+ * esse tempo, empates pelo menor id. Cada corrida tem seu fluxo do Rng por cavalo, então
+ * o resultado não depende do escalonamento. O estado das corridas é estrutura de vetores,
+ * cavalo-major: a thread do cavalo h escreve só a sua linha finish_t[h*stride ..], e cada linha
+ * começa numa linha de cache própria (stride = R arredondado para múltiplo de 16 ints), então
+ * mesmo com R pequeno dois cavalos nunca escrevem na mesma linha de cache.
+ * Cada lote tem duas fases separadas por barreira: correr (cada thread o seu cavalo em
+ * todas as corridas) e classificar (a thread h classifica as corridas s com s % H == h).
+ * ------------------------------------------------------------------------- */
+#define BATCH_SPAWN_RACES 2000  // corridas do comparativo com threads novas por corrida
+
+typedef struct {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cv;
+    int count, threshold, generation;
+} Barrier;
+
+static void barrier_init(Barrier* b, int n){
+    InitializeCriticalSection(&b->cs);
+    InitializeConditionVariable(&b->cv);
+    b->count = 0; b->threshold = n; b->generation = 0;
+}
+
+static void barrier_wait(Barrier* b){
+    EnterCriticalSection(&b->cs);
+    int gen = b->generation;
+    if (++b->count == b->threshold) {
+        b->count = 0; b->generation++;
+        WakeAllConditionVariable(&b->cv);
+    } else {
+        while (gen == b->generation) SleepConditionVariableCS(&b->cv, &b->cs, INFINITE);
+    }
+    LeaveCriticalSection(&b->cs);
+}
+
+// Estado das R corridas em andamento (estrutura de vetores).
+typedef struct {
+    int R;
+    int stride;         // ints por linha de cavalo: R arredondado para a linha de cache
+    int *finish_t;      // [cavalo*stride + corrida]: instante de chegada no relógio da corrida
+} RaceSlots;
+
+typedef struct {
+    int id;
+    long long *place;   // [cavalo*H + colocação]: contagem local desta thread
+} BatchHorse;
+
+RaceSlots slots;
+Barrier batch_barrier;
+int total_races = 100000;
+
+// Tempo de chegada de um cavalo numa corrida (mesmo modelo de passo/pausa do modo interativo).
+static int simulate_horse(int race, int h){
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), (uint64_t)race * H + h);
+    int pos = 0, t = 0;
+    while (pos < FINISH) {
+        t += 50 + rng_below(&rng, 150);
+        pos += 1 + rng_below(&rng, 10);
+    }
+    return t;
+}
+
+// Ordena os cavalos da corrida s por (chegada, id) e conta as colocações em bh->place.
+static void rank_race(BatchHorse* bh, int s){
+    int order[MAXIMUM_WAIT_OBJECTS];
+    for (int h=0;h<H;h++) {
+        int t = slots.finish_t[h*slots.stride + s];
+        int k = h;
+        while (k > 0 && slots.finish_t[order[k-1]*slots.stride + s] > t) { order[k] = order[k-1]; k--; }
+        order[k] = h;     // inserção estável: empate mantém o menor id na frente
+    }
+    for (int p=0;p<H;p++) bh->place[order[p]*H + p]++;
+}
+
+DWORD WINAPI batch_horse_thread(LPVOID arg){
+    BatchHorse* bh = (BatchHorse*)arg;
+    int h = bh->id, R = slots.R;
+    for (int base=0; base<total_races; base+=R) {
+        int n = total_races - base < R ? total_races - base : R;
+        int* row = &slots.finish_t[h*slots.stride];
+        for (int s=0;s<n;s++) row[s] = simulate_horse(base + s, h);
+        barrier_wait(&batch_barrier);
+        for (int s=h;s<n;s+=H) rank_race(bh, s);
+        barrier_wait(&batch_barrier);   // slots livres para o próximo lote
+    }
+    return 0;
+}
+
+// Comparativo: uma corrida = H threads novas, criadas e destruídas; a corrida é classificada
+// em seguida, como no pool, para que as duas vazões incluam o mesmo trabalho.
+DWORD WINAPI spawn_horse_thread(LPVOID arg){
+    int* a = (int*)arg;       // a[0] = corrida, a[1] = cavalo
+    slots.finish_t[a[1]*slots.stride] = simulate_horse(a[0], a[1]);
+    return 0;
+}
+
+static int run_batch_races(int argc, char** argv){
+    int R = argc >= 3 ? atoi(argv[2]) : 64;
+    H = argc >= 4 ? atoi(argv[3]) : 5;
+    if (argc >= 5) total_races = atoi(argv[4]);
+    if (R < 1) R = 1;
+    if (H < 2) H = 2;
+    if (H > MAXIMUM_WAIT_OBJECTS) H = MAXIMUM_WAIT_OBJECTS;
+    if (total_races < 1) total_races = 1;
+
+    printf("Corridas em lote: %d corridas, %d simultaneas, %d cavalos (pool de %d threads)\n", total_races, R, H, H);
+    const int per_line = CACHE_LINE / (int)sizeof(int);
+    slots.R = R;
+    slots.stride = (R + per_line - 1) / per_line * per_line;
+    slots.finish_t = (int*)_aligned_malloc(sizeof(int) * H * slots.stride, CACHE_LINE);
+    barrier_init(&batch_barrier, H);
+
+    BatchHorse* bh = (BatchHorse*)malloc(sizeof(BatchHorse) * H);
+    HANDLE th[MAXIMUM_WAIT_OBJECTS];
+    double t0 = now_ms();
+    for (int h=0;h<H;h++) {
+        bh[h].id = h;
+        bh[h].place = (long long*)calloc(H * H, sizeof(long long));
+        th[h] = CreateThread(NULL,0,batch_horse_thread,&bh[h],0,NULL);
+    }
+    WaitForMultipleObjects(H, th, TRUE, INFINITE);
+    double pool_ms = now_ms() - t0;
+    for (int h=0;h<H;h++) CloseHandle(th[h]);
+
+    // soma as contagens locais
+    long long* place = (long long*)calloc(H * H, sizeof(long long));
+    for (int h=0;h<H;h++) {
+        for (int i=0;i<H*H;i++) place[i] += bh[h].place[i];
+        free(bh[h].place);
+    }
+
+    // comparativo: threads novas por corrida (slot único)
+    int spawn_races = total_races < BATCH_SPAWN_RACES ? total_races : BATCH_SPAWN_RACES;
+    int args[MAXIMUM_WAIT_OBJECTS][2];
+    BatchHorse spawn_tally;
+    spawn_tally.id = 0;
+    spawn_tally.place = (long long*)calloc(H * H, sizeof(long long));
+    t0 = now_ms();
+    for (int r=0;r<spawn_races;r++) {
+        for (int h=0;h<H;h++) {
+            args[h][0] = r; args[h][1] = h;
+            th[h] = CreateThread(NULL,0,spawn_horse_thread,args[h],0,NULL);
+        }
+        WaitForMultipleObjects(H, th, TRUE, INFINITE);
+        for (int h=0;h<H;h++) CloseHandle(th[h]);
+        rank_race(&spawn_tally, 0);
+    }
+    double spawn_ms = now_ms() - t0;
+    free(spawn_tally.place);
+
+    printf("\nVitorias por cavalo:\n");
+    printf("%6s %10s %8s %12s\n", "cavalo", "vitorias", "taxa", "odd justa");
+    for (int h=0;h<H;h++) {
+        long long w = place[h*H];
+        printf("%6d %10lld %7.2f%% %12.2f\n", h, w, 100.0 * w / total_races, w ? (double)total_races / w : 0.0);
+    }
+    printf("\nDistribuicao de colocacao (%% das corridas):\n%6s", "cavalo");
+    for (int p=0;p<H;p++) printf(" %5do", p+1);
+    printf("\n");
+    for (int h=0;h<H;h++) {
+        printf("%6d", h);
+        for (int p=0;p<H;p++) printf(" %6.2f", 100.0 * place[h*H + p] / total_races);
+        printf("\n");
+    }
+
+    printf("\nPool reusado: %.0f corridas/s (%.0f ms)\n", total_races / (pool_ms / 1000.0), pool_ms);
+    printf("Threads novas por corrida: %.0f corridas/s (%d corridas, %.0f ms; tambem classificadas)\n",
+           spawn_races / (spawn_ms / 1000.0), spawn_races, spawn_ms);
+
+    DeleteCriticalSection(&batch_barrier.cs);
+    free(place); free(bh); _aligned_free(slots.finish_t);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    rng_default_seed();
+    if (argc >= 2 && strcmp(argv[1], "--fibras") == 0) return run_fiber_race(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "--lote") == 0) return run_batch_races(argc, argv);
+
     InitializeCriticalSection(&cs);
     InitializeConditionVariable(&cv_start);
 
@@ -75,11 +654,14 @@ int main(){
     fgets(bet, sizeof(bet), stdin);
     int bet_id = atoi(bet);
 
+    horses = (Horse*)malloc(sizeof(Horse)*H);
+    finish_order = (int*)malloc(sizeof(int)*H);
     HANDLE th[MAX_HORSES];
     for (int i=0;i<H;i++){
         horses[i].id = i;
         horses[i].pos = 0;
         horses[i].finished = 0;
+        rng_seed(&horses[i].rng, rng_default_seed(), i);
         finish_order[i] = -1;
         th[i] = CreateThread(NULL,0,horse_thread,&horses[i],0,NULL);
     }
@@ -107,5 +689,6 @@ int main(){
 
     for (int i=0;i<H;i++) CloseHandle(th[i]);
     DeleteCriticalSection(&cs);
+    free(horses); free(finish_order);
     return 0;
 }
@@ -3,11 +3,23 @@
 // Uma thread watchdog detecta ausência de progresso por T segundos e reporta.
 // Depois demonstra correção adotando ordem total de travamento.
 // Windows API version.
+//
+// Progresso: cada thread tem seu batimento numa linha de cache própria (escritas simples, sem
+// Interlocked) com o relógio grosso do sistema (GetTickCount64, lido da página compartilhada
+// do kernel). O watchdog varre a tabela e nomeia as threads paradas, há quanto tempo, o recurso
+// que cada uma tenta adquirir e quem o segura, seguindo a cadeia de espera até achar um ciclo.
+// Compilado com -DTRACE grava ex10_trace.json com as esperas e posses de cada recurso (trace.h).
+#ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
+#endif
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include "rng.h"
+#include "trace.h"
+#include "cache.h"
 
 #define RESOURCES 3
 #define THREADS 6
@@ -15,71 +27,140 @@
 #define RUN_MS 5000
 
 CRITICAL_SECTION resources[RESOURCES];
-volatile LONG last_progress_ms = 0; // updated on each successful lock/unlock action
 volatile LONG stop_flag = 0;
 
+// Batimento de uma thread: só ela escreve; o watchdog só lê. Uma linha de cache por thread.
+typedef struct {
+    CACHE_ALIGN volatile LONG64 beat_ms;    // último progresso (relógio grosso, ms)
+    volatile LONG64 wait_since_ms;          // início da espera atual
+    volatile LONG waiting_for;              // recurso sendo adquirido (-1 = nenhum)
+    volatile LONG holding;                  // máscara dos recursos que segura
+    LONG64 reported_beat;                   // (watchdog) batimento já relatado como parado
+} Heartbeat;
+
+Heartbeat heartbeats[THREADS];
+
 static double now_ms() {
     LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t);
     return (double)t.QuadPart*1000.0/(double)f.QuadPart;
 }
 
+// Relógio barato e monotônico (~10-16 ms de resolução, suficiente para um watchdog de segundos).
+static LONG64 coarse_ms() { return (LONG64)GetTickCount64(); }
+
+// Escrita relaxada: store alinhado de 64 bits, sem barreira nem lock (um escritor por campo).
+static void beat(Heartbeat* hb) { hb->beat_ms = coarse_ms(); }
+
+static void heartbeat_reset() {
+    LONG64 now = coarse_ms();
+    for (int i=0;i<THREADS;i++) {
+        heartbeats[i].beat_ms = now;
+        heartbeats[i].waiting_for = -1;
+        heartbeats[i].holding = 0;
+        heartbeats[i].reported_beat = -1;
+    }
+}
+
+static void acquire(Heartbeat* hb, int r) {
+    hb->wait_since_ms = coarse_ms();
+    hb->waiting_for = r;
+    TRACE_BEGIN("espera recurso");
+    EnterCriticalSection(&resources[r]);
+    TRACE_END("espera recurso");
+    TRACE_INSTANT("adquiriu", r);
+    hb->waiting_for = -1;
+    hb->holding |= 1 << r;
+    beat(hb);
+}
+
+static void release(Heartbeat* hb, int r) {
+    LeaveCriticalSection(&resources[r]);
+    hb->holding &= ~(1 << r);
+    beat(hb);
+}
+
 DWORD WINAPI worker_deadlock_prone(LPVOID arg) {
     int id = (int)(intptr_t)arg;
+    TRACE_THREAD("worker", id);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);
     // pick two distinct resources
-    int a = rand()%RESOURCES;
-    int b = rand()%RESOURCES;
-    while (b == a) b = rand()%RESOURCES;
-    int order = rand()%2; // 0 => a then b, 1 => b then a
+    int a = rng_below(&rng, RESOURCES);
+    int b = rng_below(&rng, RESOURCES);
+    while (b == a) b = rng_below(&rng, RESOURCES);
+    int order = rng_below(&rng, 2); // 0 => a then b, 1 => b then a
+    Heartbeat* hb = &heartbeats[id];
 
     while (!stop_flag) {
         // try to acquire in random order -> may deadlock with others
         if (order == 0) {
-            EnterCriticalSection(&resources[a]);
+            acquire(hb, a);
             // simulate some work
-            Sleep(10 + rand()%30);
-            EnterCriticalSection(&resources[b]);
+            Sleep(10 + rng_below(&rng, 30));
+            acquire(hb, b);
         } else {
-            EnterCriticalSection(&resources[b]);
-            Sleep(10 + rand()%30);
-            EnterCriticalSection(&resources[a]);
+            acquire(hb, b);
+            Sleep(10 + rng_below(&rng, 30));
+            acquire(hb, a);
         }
         // critical section
-        InterlockedExchange(&last_progress_ms, (LONG)now_ms());
-        Sleep(20 + rand()%30);
+        Sleep(20 + rng_below(&rng, 30));
 
         // release
-        LeaveCriticalSection(&resources[a]);
-        LeaveCriticalSection(&resources[b]);
-        InterlockedExchange(&last_progress_ms, (LONG)now_ms());
+        release(hb, a);
+        release(hb, b);
 
-        Sleep(50 + rand()%100);
+        Sleep(50 + rng_below(&rng, 100));
     }
     return 0;
 }
 
+// Dono atual do recurso r (pela tabela de batimentos), ou -1.
+static int owner_of(int r) {
+    for (int i=0;i<THREADS;i++) if (heartbeats[i].holding & (1 << r)) return i;
+    return -1;
+}
+
 DWORD WINAPI watchdog_thread(LPVOID arg) {
     (void)arg;
     while (!stop_flag) {
         Sleep(500);
-        LONG lp = last_progress_ms;
-        double diff = now_ms() - (double)lp;
-        if (lp == 0 || diff > WATCHDOG_TIMEOUT_MS) {
-            printf("[WATCHDOG] No progress detected in %.0f ms -> possible deadlock/stall\n", diff);
-            // Try to report which threads might be stuck by listing resource owners is complex in Win32 CRITICAL_SECTION.
-            // Here we just advise that deadlock likely happened.
-            // In a richer implementation we'd use TryEnterCriticalSection to probe resource ownership.
-            // Let's probe resources with TryEnterCriticalSection to see which are free/locked.
-            for (int r=0;r<RESOURCES;r++) {
-                if (TryEnterCriticalSection(&resources[r])) {
-                    // we acquired it -> it was free
-                    LeaveCriticalSection(&resources[r]);
-                    printf("  Resource %d: FREE\n", r);
-                } else {
-                    printf("  Resource %d: LOCKED (someone holds it)\n", r);
+        LONG64 now = coarse_ms();
+        for (int i=0;i<THREADS;i++) {
+            Heartbeat* hb = &heartbeats[i];
+            LONG64 last = hb->beat_ms;
+            LONG64 stall = now - last;
+            if (stall <= WATCHDOG_TIMEOUT_MS || hb->reported_beat == last) continue;
+            hb->reported_beat = last;   // um relatório por episódio de parada
+            LONG want = hb->waiting_for, held = hb->holding;
+            printf("[WATCHDOG] T%d sem progresso ha %lld ms", i, (long long)stall);
+            if (held) {
+                printf("; segura");
+                for (int r=0;r<RESOURCES;r++) if (held & (1 << r)) printf(" R%d", r);
+            }
+            if (want < 0) { printf("; nao esta esperando trava\n"); continue; }
+            printf("; esperando R%ld ha %lld ms (dono T%d)\n", want, (long long)(now - hb->wait_since_ms), owner_of(want));
+            // segue a cadeia de espera: T -> recurso -> dono -> recurso que o dono espera ...
+            printf("  cadeia: T%d", i);
+            int t = i, seen = 1 << i, cycle = 0;
+            for (int step=0; step<THREADS; step++) {
+                LONG r = heartbeats[t].waiting_for;
+                if (r < 0) { printf(" (dono nao esta bloqueado)"); break; }
+                int o = owner_of(r);
+                printf(" -> R%ld -> T%d", r, o);
+                if (o < 0) break;
+                if (seen & (1 << o)) {
+                    printf(o == i ? "  => DEADLOCK (ciclo)" : "  => preso atras de um ciclo");
+                    cycle = o == i;
+                    break;
                 }
+                seen |= 1 << o;
+                t = o;
             }
-            // reset lp baseline so repeated messages not too spammy
-            InterlockedExchange(&last_progress_ms, (LONG)now_ms());
+            printf("\n");
+            // as threads do ciclo não escrevem mais: grava o trace agora (o join da fase 1 não volta)
+            static int dumped = 0;
+            if (cycle && !dumped++) TRACE_DUMP("ex10_trace.json");
         }
     }
     return 0;
@@ -88,32 +169,41 @@ DWORD WINAPI watchdog_thread(LPVOID arg) {
 // Fixed version: enforce global resource ordering a < b < c when acquiring multiple resources.
 DWORD WINAPI worker_fixed(LPVOID arg) {
     int id = (int)(intptr_t)arg;
-    int a = rand()%RESOURCES;
-    int b = rand()%RESOURCES;
-    while (b==a) b = rand()%RESOURCES;
+    TRACE_THREAD("worker (ordem)", id);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);   // mesmos recursos da fase 1, para comparar
+    int a = rng_below(&rng, RESOURCES);
+    int b = rng_below(&rng, RESOURCES);
+    while (b==a) b = rng_below(&rng, RESOURCES);
     int first = a < b ? a : b;
     int second = a < b ? b : a;
+    Heartbeat* hb = &heartbeats[id];
     while (!stop_flag) {
-        EnterCriticalSection(&resources[first]);
-        Sleep(5 + rand()%20);
-        EnterCriticalSection(&resources[second]);
+        acquire(hb, first);
+        Sleep(5 + rng_below(&rng, 20));
+        acquire(hb, second);
 
-        InterlockedExchange(&last_progress_ms, (LONG)now_ms());
-        Sleep(15 + rand()%25);
+        Sleep(15 + rng_below(&rng, 25));
 
-        LeaveCriticalSection(&resources[second]);
-        LeaveCriticalSection(&resources[first]);
-        InterlockedExchange(&last_progress_ms, (LONG)now_ms());
+        release(hb, second);
+        release(hb, first);
 
-        Sleep(40 + rand()%80);
+        Sleep(40 + rng_below(&rng, 80));
     }
     return 0;
 }
 
 int main(int argc, char** argv) {
-    srand((unsigned)time(NULL));
+    rng_default_seed();
     for (int i=0;i<RESOURCES;i++) InitializeCriticalSection(&resources[i]);
 
+    // custo do batimento (o que cada aquisição/liberação paga para manter o watchdog ligado)
+    const int probe = 1000000;
+    double t0 = now_ms();
+    for (int i=0;i<probe;i++) beat(&heartbeats[0]);
+    printf("Custo do batimento: %.1f ns por atualizacao\n", (now_ms() - t0) * 1e6 / probe);
+    heartbeat_reset();
+
     printf("Fase 1: executando versão propensa a deadlock por %d ms...\n", RUN_MS);
     HANDLE ths[THREADS];
     for (int i=0;i<THREADS;i++) ths[i] = CreateThread(NULL,0,worker_deadlock_prone,(LPVOID)(intptr_t)i,0,NULL);
@@ -125,7 +215,7 @@ int main(int argc, char** argv) {
 
     // reset
     InterlockedExchange(&stop_flag, 0);
-    InterlockedExchange(&last_progress_ms, (LONG)now_ms());
+    heartbeat_reset();
     printf("\nFase 2: executando versão FIX (ordem total de travamento) por %d ms...\n", RUN_MS);
     for (int i=0;i<THREADS;i++) ths[i] = CreateThread(NULL,0,worker_fixed,(LPVOID)(intptr_t)i,0,NULL);
     wd = CreateThread(NULL,0,watchdog_thread,NULL,0,NULL);
@@ -136,5 +226,6 @@ int main(int argc, char** argv) {
 
     printf("Terminado. (Se a versão 1 mostrou watchdog ativo, havia perda de progresso.)\n");
     for (int i=0;i<RESOURCES;i++) DeleteCriticalSection(&resources[i]);
+    TRACE_DUMP("ex10_trace.json");
     return 0;
 }
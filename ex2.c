@@ -2,8 +2,14 @@
 // Buffer circular (bounded) com múltiplos produtores e consumidores.
 // Usa CRITICAL_SECTION + CONDITION_VARIABLE para exclusão mútua e espera sem busy-wait.
 // Simples estatísticas de throughput e tempo médio de espera.
+// Cada item leva o instante em que foi produzido; o consumidor mede a latência produção->consumo
+// (percentis) e cada thread acumula o tempo que passou bloqueada no buffer. O término usa
+// ring_close(): o último produtor fecha o buffer e os consumidores saem quando ele fica vazio.
 //
 // Compilar: cl ex2_buffer.c  OR  gcc -o ex2_buffer.exe ex2_buffer.c
+// Uso:      ex2_buffer.exe [--trabalho sleep|spin|mem] [--dist atual|fixo|exp|pareto] [--traco arq] [--fator f]
+//           (modelo de trabalho de produtores e consumidores, ver workload.h)
+//           compilado com -DTRACE grava ex2_trace.json (ver trace.h)
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
@@ -14,29 +20,50 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include "rng.h"
+#include "workload.h"
+#include "trace.h"
 
 #define MAX_BUF 128
+#define MAX_THREADS 32
 
 typedef struct {
-    int *buf;
+    int value;
+    double t_produced;      // ms (QPC)
+} Item;
+
+typedef struct {
+    Item *buf;
     int capacity;
     int head, tail, count;
+    int closed;             // sem novos itens: ring_get devolve 0 quando esvaziar
     CRITICAL_SECTION cs;
     CONDITION_VARIABLE cv_not_empty;
     CONDITION_VARIABLE cv_not_full;
 } RingBuf;
 
+// Estatísticas por thread (uma linha de cache cada, sem lock).
+typedef struct {
+    double blocked_ms;      // tempo esperando em ring_put/ring_get
+    int items;
+    double *lat; int n, cap;    // consumidores: latências produção->consumo
+    char pad[64];
+} ThreadStats;
+
 RingBuf rb;
 int producers = 2, consumers = 2;
 int total_items = 200;
-int produced = 0;
-int consumed = 0;
-LONG produced_count = 0;
+LONG next_item = 0;             // produtores reservam itens com InterlockedIncrement
+LONG active_producers = 0;      // o último a sair fecha o buffer
+ThreadStats pstats[MAX_THREADS], cstats[MAX_THREADS];
+
+double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
 
 void ring_init(RingBuf* r, int cap){
-    r->buf = (int*)malloc(sizeof(int)*cap);
+    r->buf = (Item*)malloc(sizeof(Item)*cap);
     r->capacity = cap;
     r->head = r->tail = r->count = 0;
+    r->closed = 0;
     InitializeCriticalSection(&r->cs);
     InitializeConditionVariable(&r->cv_not_empty);
     InitializeConditionVariable(&r->cv_not_full);
@@ -47,76 +74,144 @@ void ring_destroy(RingBuf* r){
     DeleteCriticalSection(&r->cs);
 }
 
-void ring_put(RingBuf* r, int v){
+void ring_put(RingBuf* r, Item v, double* blocked){
+    TRACE_BEGIN("put");
     EnterCriticalSection(&r->cs);
-    while (r->count == r->capacity) {
-        SleepConditionVariableCS(&r->cv_not_full, &r->cs, INFINITE);
+    if (r->count == r->capacity) {
+        double t0 = now_ms();
+        TRACE_BEGIN("espera cheio");
+        while (r->count == r->capacity)
+            SleepConditionVariableCS(&r->cv_not_full, &r->cs, INFINITE);
+        TRACE_END("espera cheio");
+        *blocked += now_ms() - t0;
     }
     r->buf[r->tail] = v;
     r->tail = (r->tail+1)%r->capacity;
     r->count++;
+    TRACE_COUNTER("ocupacao", r->count);
     WakeConditionVariable(&r->cv_not_empty);
     LeaveCriticalSection(&r->cs);
+    TRACE_END("put");
 }
 
-int ring_get(RingBuf* r){
+// Devolve 1 com um item em *out, ou 0 se o buffer foi fechado e já está vazio.
+int ring_get(RingBuf* r, Item* out, double* blocked){
+    TRACE_BEGIN("get");
     EnterCriticalSection(&r->cs);
-    while (r->count == 0) {
-        SleepConditionVariableCS(&r->cv_not_empty, &r->cs, INFINITE);
+    if (r->count == 0 && !r->closed) {
+        double t0 = now_ms();
+        TRACE_BEGIN("espera vazio");
+        while (r->count == 0 && !r->closed)
+            SleepConditionVariableCS(&r->cv_not_empty, &r->cs, INFINITE);
+        TRACE_END("espera vazio");
+        *blocked += now_ms() - t0;
     }
-    int v = r->buf[r->head];
+    if (r->count == 0) { LeaveCriticalSection(&r->cs); TRACE_END("get"); return 0; }
+    *out = r->buf[r->head];
     r->head = (r->head+1)%r->capacity;
     r->count--;
+    TRACE_COUNTER("ocupacao", r->count);
     WakeConditionVariable(&r->cv_not_full);
     LeaveCriticalSection(&r->cs);
-    return v;
+    TRACE_END("get");
+    return 1;
+}
+
+// Nenhum item novo será inserido: acorda todos os consumidores para drenarem e saírem.
+void ring_close(RingBuf* r){
+    EnterCriticalSection(&r->cs);
+    r->closed = 1;
+    WakeAllConditionVariable(&r->cv_not_empty);
+    LeaveCriticalSection(&r->cs);
+}
+
+void record_latency(ThreadStats* s, double ms){
+    if (s->n == s->cap) { s->cap = s->cap ? s->cap*2 : 256; s->lat = (double*)realloc(s->lat, sizeof(double)*s->cap); }
+    s->lat[s->n++] = ms;
+}
+
+int cmp_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
 }
 
 DWORD WINAPI producer(LPVOID arg){
     int id = (int)(intptr_t)arg;
+    ThreadStats* st = &pstats[id];
+    TRACE_THREAD("produtor", id);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);
+    Work w;
+    work_init(&w, id);
     while (1) {
-        EnterCriticalSection(&rb.cs);
-        if (produced >= total_items) {
-            LeaveCriticalSection(&rb.cs);
-            break;
-        }
-        produced++;
-        int item = produced;
-        LeaveCriticalSection(&rb.cs);
+        LONG item = InterlockedIncrement(&next_item);
+        if (item > total_items) break;
 
         // simulate work
-        Sleep(rand()%50);
-        ring_put(&rb, item);
-        InterlockedIncrement(&produced_count);
+        work_ms(&w, &rng, 0, 50);
+        Item it = { (int)item, now_ms() };
+        ring_put(&rb, it, &st->blocked_ms);
+        st->items++;
         // optional: print
         // printf("P%d produced %d\n", id, item);
     }
+    if (InterlockedDecrement(&active_producers) == 0) ring_close(&rb);
+    work_free(&w);
     return 0;
 }
 
 DWORD WINAPI consumer(LPVOID arg){
     int id = (int)(intptr_t)arg;
-    while (1) {
-        EnterCriticalSection(&rb.cs);
-        if (consumed >= total_items) {
-            LeaveCriticalSection(&rb.cs);
-            break;
-        }
-        LeaveCriticalSection(&rb.cs);
-
-        int item = ring_get(&rb);
+    ThreadStats* st = &cstats[id];
+    TRACE_THREAD("consumidor", id);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), MAX_THREADS + id);
+    Work w;
+    work_init(&w, MAX_THREADS + id);
+    Item it;
+    while (ring_get(&rb, &it, &st->blocked_ms)) {
+        record_latency(st, now_ms() - it.t_produced);
         // process
-        Sleep(rand()%80);
-        EnterCriticalSection(&rb.cs);
-        consumed++;
-        LeaveCriticalSection(&rb.cs);
-        // printf("C%d consumed %d\n", id, item);
+        work_ms(&w, &rng, 0, 80);
+        st->items++;
+        // printf("C%d consumed %d\n", id, it.value);
     }
+    work_free(&w);
     return 0;
 }
 
-int main(){
-    srand((unsigned)time(NULL));
+void print_stats(double elapsed_ms){
+    int n = 0, consumed = 0, produced = 0;
+    for (int i=0;i<consumers;i++) { n += cstats[i].n; consumed += cstats[i].items; }
+    for (int i=0;i<producers;i++) produced += pstats[i].items;
+    double* all = (double*)malloc(sizeof(double)*(n ? n : 1));
+    double sum = 0;
+    n = 0;
+    for (int i=0;i<consumers;i++)
+        for (int k=0;k<cstats[i].n;k++) { all[n++] = cstats[i].lat[k]; sum += cstats[i].lat[k]; }
+    qsort(all, n, sizeof(double), cmp_double);
+
+    printf("Done. produced=%d consumed=%d\n", produced, consumed);
+    printf("Throughput: %.1f itens/s (%.1f ms)\n", consumed * 1000.0 / elapsed_ms, elapsed_ms);
+    if (n)
+        printf("Latencia producao->consumo (ms): media=%.2f p50=%.2f p90=%.2f p99=%.2f max=%.2f\n",
+               sum / n, all[n/2], all[(int)(0.90*(n-1))], all[(int)(0.99*(n-1))], all[n-1]);
+    printf("Tempo bloqueado no buffer (ms):\n");
+    for (int i=0;i<producers;i++)
+        printf("  P%-2d %9.1f  (%d itens, %.2f ms/item)\n", i, pstats[i].blocked_ms, pstats[i].items,
+               pstats[i].items ? pstats[i].blocked_ms / pstats[i].items : 0.0);
+    for (int i=0;i<consumers;i++)
+        printf("  C%-2d %9.1f  (%d itens, %.2f ms/item)\n", i, cstats[i].blocked_ms, cstats[i].items,
+               cstats[i].items ? cstats[i].blocked_ms / cstats[i].items : 0.0);
+    free(all);
+    for (int i=0;i<consumers;i++) free(cstats[i].lat);
+}
+
+int main(int argc, char** argv){
+    rng_default_seed();
+    for (int i=1;i<argc;i++)
+        if (!work_arg(argc, argv, &i)) { printf("Opcao desconhecida '%s'\n", argv[i]); return 1; }
+    work_setup();
     int bufsize = 8;
     printf("Buffer size (N): ");
     scanf("%d",&bufsize);
@@ -127,21 +222,29 @@ int main(){
     printf("Total items: ");
     scanf("%d",&total_items);
 
+    if (bufsize < 1) bufsize = 1;
+    if (producers < 1) producers = 1;
+    if (producers > MAX_THREADS) producers = MAX_THREADS;
+    if (consumers < 1) consumers = 1;
+    if (consumers > MAX_THREADS) consumers = MAX_THREADS;
+
     ring_init(&rb, bufsize);
+    active_producers = producers;
 
-    HANDLE pth[32], cth[32];
+    HANDLE pth[MAX_THREADS], cth[MAX_THREADS];
+    double t0 = now_ms();
     for (int i=0;i<producers;i++) pth[i] = CreateThread(NULL,0,producer,(LPVOID)(intptr_t)i,0,NULL);
     for (int i=0;i<consumers;i++) cth[i] = CreateThread(NULL,0,consumer,(LPVOID)(intptr_t)i,0,NULL);
 
+    // o último produtor fecha o buffer; os consumidores drenam o que resta e saem
     WaitForMultipleObjects(producers, pth, TRUE, INFINITE);
-    // Ensure consumers wake up if waiting and items finished
-    EnterCriticalSection(&rb.cs);
-    WakeAllConditionVariable(&rb.cv_not_empty);
-    LeaveCriticalSection(&rb.cs);
-
     WaitForMultipleObjects(consumers, cth, TRUE, INFINITE);
+    double elapsed = now_ms() - t0;
+    for (int i=0;i<producers;i++) CloseHandle(pth[i]);
+    for (int i=0;i<consumers;i++) CloseHandle(cth[i]);
 
-    printf("Done. produced=%ld consumed=%d\n", produced_count, consumed);
+    print_stats(elapsed);
     ring_destroy(&rb);
+    TRACE_DUMP("ex2_trace.json");
     return 0;
 }
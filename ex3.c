@@ -3,87 +3,287 @@
 // Protege saldos com mutex por conta; verifica (asserção) que soma total permanece constante.
 // Também proporciona uma execução "sem trava" para evidenciar condição de corrida.
 //
+// Layouts de memória das contas (--layout); todos usam SRWLOCK, então só o layout muda:
+//   atual    - saldos (double) e travas em vetores separados, como no original (8 saldos por linha)
+//   padded   - trava + saldo + dados da conta juntos, uma conta por linha de 64 bytes
+//   soa      - vetores compactos de travas e de saldos, alinhados a 64 bytes (estrutura de vetores)
+//   hotcold  - parte quente (trava + saldo, 16 bytes) separada dos dados frios da conta
+//   atual-cs - referência de trava, não de layout: o atual com CRITICAL_SECTION (a trava original)
+// --matriz executa todos os layouts para T = 1, 2, 4, ... e imprime transferências/s e ciclos por
+// transferência (QueryThreadCycleTime), que sobem com as falhas de cache e o tráfego de coerência.
+// Compilado com -DTRACE grava ex3_trace.json com as esperas pelas travas das contas (trace.h).
+//
 // Compilar: cl ex3_transferencias.c  OR  gcc -o ex3_transferencias.exe ex3_transferencias.c
+// Uso:      ex3_transferencias.exe [--layout atual|padded|soa|hotcold|atual-cs]   (interativo)
+//           ex3_transferencias.exe --matriz [M] [ops_por_thread]
 
+#ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
+#endif
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <malloc.h>
 #include <time.h>
+#include "rng.h"
+#include "trace.h"
+#include "cache.h"
+
+#define MAX_THREADS 64
+
+typedef enum { LAYOUT_ATUAL, LAYOUT_PADDED, LAYOUT_SOA, LAYOUT_HOTCOLD, LAYOUT_ATUAL_CS, N_LAYOUTS } Layout;
+const char* layout_names[N_LAYOUTS] = { "atual", "padded", "soa", "hotcold", "atual-cs" };
+
+// Dados "frios": só lidos/escritos fora das transferências (abertura e auditoria).
+typedef struct {
+    long long id;
+    long long opened;
+    char owner[24];
+} AccountInfo;
+
+// padded: tudo da conta numa linha de cache, nenhuma conta divide linha com outra.
+typedef struct {
+    CACHE_ALIGN SRWLOCK lock;
+    double balance;
+    AccountInfo info;
+} PaddedAccount;
 
-#define MAX_ACCOUNTS 64
+// hotcold: só o que a transferência toca fica no vetor quente (4 contas por linha).
+typedef struct {
+    SRWLOCK lock;
+    double balance;
+} HotAccount;
+
+Layout layout = LAYOUT_ATUAL;
+double *balances;               // atual, atual-cs
+SRWLOCK *acc_locks;             // atual
+CRITICAL_SECTION *acc_cs;       // atual-cs
+PaddedAccount *padded;          // padded
+SRWLOCK *soa_locks;             // soa
+double *soa_balances;           // soa
+HotAccount *hot;                // hotcold
+AccountInfo *cold;              // hotcold (e dados frios de atual/soa)
 
-double balances[MAX_ACCOUNTS];
-CRITICAL_SECTION acc_cs[MAX_ACCOUNTS];
 int M = 8; // contas
 int T = 4; // threads
 int ops_per_thread = 10000;
 int use_locks = 1;
+HANDLE start_evt;               // largada simultânea das threads
+LONG64 thread_cycles[MAX_THREADS];
+
+static double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
+
+static double* balance_of(int i){
+    switch (layout){
+    case LAYOUT_PADDED:  return &padded[i].balance;
+    case LAYOUT_SOA:     return &soa_balances[i];
+    case LAYOUT_HOTCOLD: return &hot[i].balance;
+    default:             return &balances[i];
+    }
+}
+static void lock_acc(int i){
+    TRACE_BEGIN("trava conta");
+    switch (layout){
+    case LAYOUT_PADDED:  AcquireSRWLockExclusive(&padded[i].lock); break;
+    case LAYOUT_SOA:     AcquireSRWLockExclusive(&soa_locks[i]); break;
+    case LAYOUT_HOTCOLD: AcquireSRWLockExclusive(&hot[i].lock); break;
+    case LAYOUT_ATUAL_CS: EnterCriticalSection(&acc_cs[i]); break;
+    default:             AcquireSRWLockExclusive(&acc_locks[i]); break;
+    }
+    TRACE_END("trava conta");
+}
+static void unlock_acc(int i){
+    switch (layout){
+    case LAYOUT_PADDED:  ReleaseSRWLockExclusive(&padded[i].lock); break;
+    case LAYOUT_SOA:     ReleaseSRWLockExclusive(&soa_locks[i]); break;
+    case LAYOUT_HOTCOLD: ReleaseSRWLockExclusive(&hot[i].lock); break;
+    case LAYOUT_ATUAL_CS: LeaveCriticalSection(&acc_cs[i]); break;
+    default:             ReleaseSRWLockExclusive(&acc_locks[i]); break;
+    }
+}
+
+void accounts_init(){
+    cold = (AccountInfo*)calloc(M, sizeof(AccountInfo));
+    switch (layout){
+    case LAYOUT_PADDED:
+        padded = (PaddedAccount*)_aligned_malloc(sizeof(PaddedAccount)*M, 64);
+        memset(padded, 0, sizeof(PaddedAccount)*M);
+        for (int i=0;i<M;i++) InitializeSRWLock(&padded[i].lock);
+        break;
+    case LAYOUT_SOA:
+        soa_locks = (SRWLOCK*)_aligned_malloc(sizeof(SRWLOCK)*M, 64);
+        soa_balances = (double*)_aligned_malloc(sizeof(double)*M, 64);
+        for (int i=0;i<M;i++) InitializeSRWLock(&soa_locks[i]);
+        break;
+    case LAYOUT_HOTCOLD:
+        hot = (HotAccount*)_aligned_malloc(sizeof(HotAccount)*M, 64);
+        for (int i=0;i<M;i++) InitializeSRWLock(&hot[i].lock);
+        break;
+    case LAYOUT_ATUAL_CS:
+        balances = (double*)malloc(sizeof(double)*M);
+        acc_cs = (CRITICAL_SECTION*)malloc(sizeof(CRITICAL_SECTION)*M);
+        for (int i=0;i<M;i++) InitializeCriticalSection(&acc_cs[i]);
+        break;
+    default:
+        balances = (double*)malloc(sizeof(double)*M);
+        acc_locks = (SRWLOCK*)malloc(sizeof(SRWLOCK)*M);
+        for (int i=0;i<M;i++) InitializeSRWLock(&acc_locks[i]);
+        break;
+    }
+    for (int i=0;i<M;i++){
+        AccountInfo* info = layout == LAYOUT_PADDED ? &padded[i].info : &cold[i];
+        info->id = i;
+        info->opened = (long long)time(NULL);
+        snprintf(info->owner, sizeof(info->owner), "cliente-%d", i);
+        *balance_of(i) = 1000.0; // saldo inicial
+    }
+}
+
+void accounts_free(){
+    switch (layout){
+    case LAYOUT_PADDED:  _aligned_free(padded); break;
+    case LAYOUT_SOA:     _aligned_free(soa_locks); _aligned_free(soa_balances); break;
+    case LAYOUT_HOTCOLD: _aligned_free(hot); break;
+    case LAYOUT_ATUAL_CS:
+        for (int i=0;i<M;i++) DeleteCriticalSection(&acc_cs[i]);
+        free(balances); free(acc_cs);
+        break;
+    default:             free(balances); free(acc_locks); break;
+    }
+    free(cold);
+}
 
 DWORD WINAPI transfer_thread(LPVOID arg){
-    unsigned int seed = (unsigned int)GetTickCount() ^ (unsigned int)(intptr_t)arg;
+    int id = (int)(intptr_t)arg;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);
+    TRACE_THREAD("transferencias", id);
+    WaitForSingleObject(start_evt, INFINITE);
+    ULONG64 c0 = 0, c1 = 0;
+    QueryThreadCycleTime(GetCurrentThread(), &c0);
     for (int k=0;k<ops_per_thread;k++){
-        int a = rand_r(&seed) % M;
-        int b = rand_r(&seed) % M;
-        double amount = (rand_r(&seed) % 1000) / 100.0;
+        int a = (int)rng_below(&rng, M);
+        int b = (int)rng_below(&rng, M);
+        double amount = rng_below(&rng, 1000) / 100.0;
         if (a==b) continue;
 
+        double *ba = balance_of(a), *bb = balance_of(b);
         if (use_locks){
             // lock ordering to prevent deadlock: lock smaller index first
             int first = a < b ? a : b;
             int second = a < b ? b : a;
-            EnterCriticalSection(&acc_cs[first]);
-            EnterCriticalSection(&acc_cs[second]);
+            lock_acc(first);
+            lock_acc(second);
 
-            if (balances[a] >= amount){
-                balances[a] -= amount;
-                balances[b] += amount;
+            if (*ba >= amount){
+                *ba -= amount;
+                *bb += amount;
             }
 
-            LeaveCriticalSection(&acc_cs[second]);
-            LeaveCriticalSection(&acc_cs[first]);
+            unlock_acc(second);
+            unlock_acc(first);
         } else {
             // no locks - race condition likely
-            if (balances[a] >= amount){
-                balances[a] -= amount;
-                balances[b] += amount;
+            if (*ba >= amount){
+                *ba -= amount;
+                *bb += amount;
             }
         }
     }
+    QueryThreadCycleTime(GetCurrentThread(), &c1);
+    thread_cycles[id] = (LONG64)(c1 - c0);
     return 0;
 }
 
 double total_balance(){
     double s=0;
-    for (int i=0;i<M;i++) s += balances[i];
+    for (int i=0;i<M;i++) s += *balance_of(i);
     return s;
 }
 
-int main(){
-    srand((unsigned)time(NULL));
+// Uma execução completa; devolve o tempo em ms e a soma final em *final.
+double run_transfers(double* final, double* cycles_per_op){
+    start_evt = CreateEvent(NULL, TRUE, FALSE, NULL);
+    HANDLE th[MAX_THREADS];
+    for (int i=0;i<T;i++) th[i] = CreateThread(NULL,0,transfer_thread,(LPVOID)(intptr_t)i,0,NULL);
+    double t0 = now_ms();
+    SetEvent(start_evt);
+    WaitForMultipleObjects(T, th, TRUE, INFINITE);
+    double ms = now_ms() - t0;
+    double cycles = 0;
+    for (int i=0;i<T;i++) { CloseHandle(th[i]); cycles += (double)thread_cycles[i]; }
+    CloseHandle(start_evt);
+    *final = total_balance();
+    *cycles_per_op = cycles / ((double)T * ops_per_thread);
+    return ms;
+}
+
+// Matriz layout x threads: transferências/s e ciclos por transferência.
+void run_matrix(){
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int max_t = (int)si.dwNumberOfProcessors * 2;
+    if (max_t > MAX_THREADS) max_t = MAX_THREADS;
+    printf("M=%d contas, %d ops por thread (SRWLOCK por conta, ordem global)\n", M, ops_per_thread);
+    printf("%-8s %4s %14s %12s %8s\n", "layout", "T", "transf/s", "ciclos/op", "soma");
+    for (int l=0;l<N_LAYOUTS;l++){
+        layout = (Layout)l;
+        if (layout == LAYOUT_ATUAL_CS) printf("-- referencia de trava: layout atual com CRITICAL_SECTION --\n");
+        for (T=1; T<=max_t; T*=2){
+            accounts_init();
+            double initial = total_balance(), final, cpo;
+            double ms = run_transfers(&final, &cpo);
+            printf("%-8s %4d %14.0f %12.0f %8s\n", layout_names[l], T, (double)T * ops_per_thread * 1000.0 / ms,
+                   cpo, fabs(final - initial) > 0.01 ? "ERRO" : "ok");
+            accounts_free();
+        }
+    }
+}
+
+int main(int argc, char** argv){
+    rng_default_seed();
+    for (int i=1;i<argc;i++){
+        if (strcmp(argv[i], "--layout") == 0 && i+1 < argc){
+            const char* n = argv[++i];
+            int l;
+            for (l=0;l<N_LAYOUTS && strcmp(n, layout_names[l]);l++);
+            if (l == N_LAYOUTS) { printf("Layout desconhecido '%s' (atual, padded, soa, hotcold, atual-cs)\n", n); return 1; }
+            layout = (Layout)l;
+        } else if (strcmp(argv[i], "--matriz") == 0){
+            M = 64; ops_per_thread = 200000;
+            if (i+1 < argc) M = atoi(argv[++i]);
+            if (i+1 < argc) ops_per_thread = atoi(argv[++i]);
+            if (M < 2) M = 2;
+            run_matrix();
+            TRACE_DUMP("ex3_trace.json");
+            return 0;
+        }
+    }
     printf("Contas (M) ? "); scanf("%d",&M);
     printf("Threads (T) ? "); scanf("%d",&T);
     printf("Ops por thread ? "); scanf("%d",&ops_per_thread);
     printf("Usar locks? (1=sim,0=nao) ? "); scanf("%d",&use_locks);
+    if (M < 2) M = 2;
+    if (T < 1) T = 1;
+    if (T > MAX_THREADS) T = MAX_THREADS;
 
-    for (int i=0;i<M;i++){
-        balances[i] = 1000.0; // saldo inicial
-        InitializeCriticalSection(&acc_cs[i]);
-    }
+    accounts_init();
     double initial = total_balance();
-    printf("Soma inicial: %.2f\n", initial);
-
-    HANDLE th[128];
-    for (int i=0;i<T;i++) th[i] = CreateThread(NULL,0,transfer_thread,(LPVOID)(intptr_t)i,0,NULL);
-    WaitForMultipleObjects(T, th, TRUE, INFINITE);
+    printf("Soma inicial: %.2f (layout %s)\n", initial, layout_names[layout]);
 
-    double final = total_balance();
+    double final, cpo;
+    double ms = run_transfers(&final, &cpo);
     printf("Soma final: %.2f\n", final);
     if (fabs(final - initial) > 0.01) {
         printf("ASSERT FAIL: soma global mudou! (condição de corrida provavelmente)\n");
     } else {
         printf("OK: soma global preservada.\n");
     }
-    for (int i=0;i<M;i++) DeleteCriticalSection(&acc_cs[i]);
+    printf("Tempo: %.1f ms (%.0f transf/s, %.0f ciclos/op)\n", ms, (double)T * ops_per_thread * 1000.0 / ms, cpo);
+    accounts_free();
+    TRACE_DUMP("ex3_trace.json");
     return 0;
 }
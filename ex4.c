@@ -1,9 +1,30 @@
 // ex4_linha_processamento.c
-// Pipeline com 3 estágios: captura -> processamento -> gravação.
-// Usa duas filas limitadas (ring buffers) protegidas com CRITICAL_SECTION + CONDITION_VARIABLE.
-// Usa "poison pill" (-1) para sinalizar finalização limpa.
+// Pipeline configurável: captura -> N etapas de processamento -> gravação.
+// Cada etapa tem seu número de workers e a capacidade da sua fila de entrada
+// (ring buffers protegidos com CRITICAL_SECTION + CONDITION_VARIABLE).
+// Usa "poison pill" para sinalizar finalização limpa, mesmo com vários workers por etapa,
+// e um buffer de reordenação para que a gravação veja os itens na ordem de captura.
+// Ao final imprime a utilização de cada etapa (gargalos ficam visíveis).
+//
+// Transporte em lotes sem cópia: as filas carregam ponteiros para lotes de registros
+// tirados de um pool reciclado; nada é copiado nem alocado por item. A captura fecha
+// o lote por tamanho ou por prazo, e o tamanho alvo se adapta à pressão da fila seguinte.
 //
 // Compilar: cl ex4_linha_processamento.c  OR  gcc -o ex4_linha_processamento.exe ex4_linha_processamento.c
+// Uso: ex4_linha_processamento.exe [--lote B] [W:C ...]
+//      cada W:C adiciona uma etapa de processamento com W workers e fila de entrada C (em lotes)
+//      (padrão: uma etapa 1:8, equivalente ao pipeline original de 3 estágios)
+//      --lote B: tamanho máximo do lote adaptativo (padrão 1 = item a item)
+//      ex4_linha_processamento.exe --bench-lotes [W:C ...]
+//      mede itens/s e latência por item para lotes de 1 a 4096, sem Sleep nem printf
+//      --saida arq: a gravação escreve os registros em arq com I/O assíncrono (OVERLAPPED);
+//      --io-thread força o fallback com thread de escrita dedicada; --direct usa FILE_FLAG_NO_BUFFERING
+//      (o NTFS completa de forma síncrona escritas além do "valid data length": o arquivo é pré-alocado,
+//      mas sem o privilégio de SetFileValidData o modo overlapped pode medir escrita síncrona; o
+//      número de escritas síncronas sai junto com os resultados)
+//      --trabalho sleep|spin|mem, --dist, --traco, --fator: modelo do trabalho simulado de captura,
+//      processamento e gravação (workload.h; padrão: Sleep)
+//      compilado com -DTRACE grava ex4_trace.json (filas, lotes e etapas; ver trace.h)
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
@@ -11,95 +32,703 @@
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "rng.h"
+#include "workload.h"
+#include "trace.h"
 
 #define BUF1 8
 #define BUF2 8
 #define N_ITEMS 50
+#define MAX_STAGES 16
+#define MAX_STAGE_WORKERS 64
+#define POISON (-1)     // seq do lote "poison pill"
+#define RECORD_BYTES 1024
+#define BATCH_DEADLINE_MS 20.0
+#define BENCH_ITEMS 200000
+#define BENCH_MAX_BATCH 4096
+
+typedef struct {
+    int seq;
+    int val;
+    double t_capture;
+    char payload[RECORD_BYTES];
+} Record;
 
 typedef struct {
-    int *buf; int cap; int head, tail, cnt;
+    int seq;            // ordem do lote na captura (chave do buffer de reordenação)
+    int n;
+    Record rec[];       // capacidade = batch_max
+} Batch;
+
+typedef struct {
+    Batch **buf; int cap; int head, tail, cnt;
     CRITICAL_SECTION cs;
     CONDITION_VARIABLE not_empty, not_full;
 } Ring;
 
+static double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
+
 void ring_init(Ring* r, int cap){
-    r->buf = malloc(sizeof(int)*cap);
+    r->buf = malloc(sizeof(Batch*)*cap);
     r->cap = cap; r->head=r->tail=r->cnt=0;
     InitializeCriticalSection(&r->cs);
     InitializeConditionVariable(&r->not_empty);
     InitializeConditionVariable(&r->not_full);
 }
-void ring_put(Ring* r, int v){
+void ring_destroy(Ring* r){
+    free(r->buf);
+    DeleteCriticalSection(&r->cs);
+}
+void ring_put(Ring* r, Batch* v){
+    TRACE_BEGIN("put");
     EnterCriticalSection(&r->cs);
-    while(r->cnt==r->cap) SleepConditionVariableCS(&r->not_full,&r->cs,INFINITE);
+    if (r->cnt==r->cap) {
+        TRACE_BEGIN("espera cheio");
+        while(r->cnt==r->cap) SleepConditionVariableCS(&r->not_full,&r->cs,INFINITE);
+        TRACE_END("espera cheio");
+    }
     r->buf[r->tail]=v; r->tail=(r->tail+1)%r->cap; r->cnt++;
     WakeConditionVariable(&r->not_empty);
     LeaveCriticalSection(&r->cs);
+    TRACE_END("put");
 }
-int ring_get(Ring* r){
+Batch* ring_get(Ring* r){
+    TRACE_BEGIN("get");
     EnterCriticalSection(&r->cs);
-    while(r->cnt==0) SleepConditionVariableCS(&r->not_empty,&r->cs,INFINITE);
-    int v = r->buf[r->head]; r->head=(r->head+1)%r->cap; r->cnt--;
+    if (r->cnt==0) {
+        TRACE_BEGIN("espera vazio");
+        while(r->cnt==0) SleepConditionVariableCS(&r->not_empty,&r->cs,INFINITE);
+        TRACE_END("espera vazio");
+    }
+    Batch* v = r->buf[r->head]; r->head=(r->head+1)%r->cap; r->cnt--;
     WakeConditionVariable(&r->not_full);
     LeaveCriticalSection(&r->cs);
+    TRACE_END("get");
     return v;
 }
+int ring_count(Ring* r){
+    EnterCriticalSection(&r->cs);
+    int c = r->cnt;
+    LeaveCriticalSection(&r->cs);
+    return c;
+}
+
+/* ---------------------------------------------------------------------------
+ * Gravação assíncrona em arquivo
+ *
+ * Double buffer de AW_BUF bytes: enquanto uma metade é gravada, a gravação
+ * preenche a outra. Caminho principal: WriteFile com OVERLAPPED (I/O
+ * assíncrono nativo do Windows). Fallback: uma thread dedicada faz WriteFile
+ * posicional (equivalente a pwrite). Com --direct o arquivo é aberto com
+ * FILE_FLAG_NO_BUFFERING (buffers e tamanhos alinhados ao setor).
+ *
+ * O NTFS completa de forma síncrona as escritas que estendem o arquivo ou que passam
+ * do "valid data length", mesmo com OVERLAPPED. Por isso o arquivo é pré-alocado no
+ * tamanho final e, se o processo tiver SE_MANAGE_VOLUME_NAME (em geral só como
+ * administrador), SetFileValidData marca tudo como válido. Sem o privilégio as escritas
+ * continuam síncronas; a contagem de escritas síncronas sai junto com os resultados.
+ * ------------------------------------------------------------------------- */
+#define AW_BUF (1<<20)          // cada metade do double buffer (múltiplo de AW_SECTOR)
+#define AW_SECTOR 4096
+#define AW_MAX_WRITES 65536     // amostras de latência de escrita
+
+enum { IO_OVERLAPPED, IO_THREAD };
+
+typedef struct {
+    HANDLE file;
+    int mode, direct;
+    char *buf[2];
+    int cur;
+    size_t fill;                // bytes na metade corrente
+    LONGLONG offset;            // próximo offset no arquivo (com padding)
+    LONGLONG logical;           // bytes de dados efetivos
+    OVERLAPPED ov[2];
+    size_t len[2];
+    int pending[2];
+    double t_submit[2], t_done[2];
+    double stall_ms;            // tempo em que a gravação esperou uma metade livre
+    float *wlat; int nw;        // latência submit -> conclusão de cada escrita
+    int nsubmit, sync_writes;   // OVERLAPPED: escritas que WriteFile completou na hora
+    int prealloc, valid_data;   // arquivo pré-alocado; SetFileValidData aceito
+    // fallback com thread dedicada
+    HANDLE thread;
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cv;
+    int job[2], done[2], stop;
+} AsyncWriter;
+
+DWORD WINAPI aw_thread(LPVOID arg){
+    AsyncWriter* w = (AsyncWriter*)arg;
+    for (int k=0;;k^=1){
+        EnterCriticalSection(&w->cs);
+        while (!w->job[k] && !w->stop) SleepConditionVariableCS(&w->cv, &w->cs, INFINITE);
+        if (!w->job[k]) { LeaveCriticalSection(&w->cs); break; }
+        LeaveCriticalSection(&w->cs);
+        DWORD n;
+        if (!WriteFile(w->file, w->buf[k], (DWORD)w->len[k], &n, &w->ov[k]))
+            printf("WriteFile falhou (%lu)\n", GetLastError());
+        EnterCriticalSection(&w->cs);
+        w->t_done[k] = now_ms();
+        w->job[k] = 0; w->done[k] = 1;
+        WakeAllConditionVariable(&w->cv);
+        LeaveCriticalSection(&w->cs);
+    }
+    return 0;
+}
+
+// Habilita SE_MANAGE_VOLUME_NAME no token do processo (exigido por SetFileValidData).
+static int aw_enable_volume_privilege(){
+    HANDLE tok;
+    TOKEN_PRIVILEGES tp;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &tok)) return 0;
+    tp.PrivilegeCount = 1;
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    int ok = LookupPrivilegeValue(NULL, SE_MANAGE_VOLUME_NAME, &tp.Privileges[0].Luid)
+             && AdjustTokenPrivileges(tok, FALSE, &tp, 0, NULL, NULL)
+             && GetLastError() == ERROR_SUCCESS;      // ERROR_NOT_ALL_ASSIGNED: sem o privilégio
+    CloseHandle(tok);
+    return ok;
+}
+
+// Reserva o tamanho final (arredondado ao setor) antes da primeira escrita. SetFileValidData
+// dispensa o NTFS de zerar o trecho, e o conteúdo antigo do disco fica visível até ser
+// sobrescrito. Aqui todo o trecho é sobrescrito e o excesso é cortado em aw_close.
+static void aw_preallocate(AsyncWriter* w, LONGLONG bytes){
+    bytes = (bytes + AW_SECTOR-1) / AW_SECTOR * AW_SECTOR;
+    FILE_ALLOCATION_INFO alloc;
+    FILE_END_OF_FILE_INFO eof;
+    alloc.AllocationSize.QuadPart = bytes;
+    eof.EndOfFile.QuadPart = bytes;
+    if (!SetFileInformationByHandle(w->file, FileAllocationInfo, &alloc, sizeof(alloc))
+        || !SetFileInformationByHandle(w->file, FileEndOfFileInfo, &eof, sizeof(eof))) {
+        printf("Pre-alocacao de %lld bytes falhou (%lu)\n", bytes, GetLastError());
+        return;
+    }
+    w->prealloc = 1;
+    w->valid_data = aw_enable_volume_privilege() && SetFileValidData(w->file, bytes);
+}
 
-Ring q1, q2;
+// expect: bytes que serão gravados (para a pré-alocação).
+int aw_open(AsyncWriter* w, const char* path, int mode, int direct, LONGLONG expect){
+    memset(w, 0, sizeof(*w));
+    w->direct = direct;
+    for (int i=0;i<2;i++){
+        // VirtualAlloc devolve memória alinhada à página, o que NO_BUFFERING exige
+        w->buf[i] = (char*)VirtualAlloc(NULL, AW_BUF, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+        if (!w->buf[i]) {
+            printf("Sem memoria para o buffer de gravacao (%lu)\n", GetLastError());
+            if (i) VirtualFree(w->buf[0], 0, MEM_RELEASE);
+            return 0;
+        }
+    }
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | (direct ? FILE_FLAG_NO_BUFFERING : 0);
+    w->file = INVALID_HANDLE_VALUE;
+    if (mode == IO_OVERLAPPED) {
+        w->file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags | FILE_FLAG_OVERLAPPED, NULL);
+        if (w->file == INVALID_HANDLE_VALUE) printf("I/O assíncrono indisponível (%lu); usando thread dedicada\n", GetLastError());
+        else w->mode = IO_OVERLAPPED;
+    }
+    if (w->file == INVALID_HANDLE_VALUE) {
+        w->file = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+        if (w->file == INVALID_HANDLE_VALUE) {
+            printf("Nao foi possivel abrir %s (%lu)\n", path, GetLastError());
+            for (int i=0;i<2;i++) VirtualFree(w->buf[i], 0, MEM_RELEASE);
+            return 0;
+        }
+        w->mode = IO_THREAD;
+        InitializeCriticalSection(&w->cs);
+        InitializeConditionVariable(&w->cv);
+        w->thread = CreateThread(NULL,0,aw_thread,w,0,NULL);
+    }
+    aw_preallocate(w, expect);
+    if (w->mode == IO_OVERLAPPED)
+        for (int i=0;i<2;i++) w->ov[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    w->wlat = (float*)malloc(sizeof(float)*AW_MAX_WRITES);
+    return 1;
+}
+
+static void aw_complete(AsyncWriter* w, int i, double t_done){
+    if (w->nw < AW_MAX_WRITES) w->wlat[w->nw++] = (float)(t_done - w->t_submit[i]);
+    w->pending[i] = 0;
+}
+
+static void aw_submit(AsyncWriter* w, int i, size_t len){
+    OVERLAPPED* ov = &w->ov[i];
+    ov->Offset = (DWORD)(w->offset & 0xFFFFFFFF);
+    ov->OffsetHigh = (DWORD)(w->offset >> 32);
+    w->offset += len;
+    w->len[i] = len;
+    w->t_submit[i] = now_ms();
+    w->pending[i] = 1;
+    w->nsubmit++;
+    if (w->mode == IO_OVERLAPPED) {
+        if (WriteFile(w->file, w->buf[i], (DWORD)len, NULL, ov)) {
+            w->sync_writes++;       // completou antes de retornar: nada ficou em voo
+        } else if (GetLastError() != ERROR_IO_PENDING) {
+            printf("WriteFile falhou (%lu)\n", GetLastError());
+            w->pending[i] = 0;
+        }
+    } else {
+        EnterCriticalSection(&w->cs);
+        w->done[i] = 0; w->job[i] = 1;
+        WakeAllConditionVariable(&w->cv);
+        LeaveCriticalSection(&w->cs);
+    }
+}
+
+// Espera a metade i ficar livre (bloqueante).
+static void aw_wait(AsyncWriter* w, int i){
+    if (!w->pending[i]) return;
+    double t0 = now_ms();
+    if (w->mode == IO_OVERLAPPED) {
+        DWORD n;
+        GetOverlappedResult(w->file, &w->ov[i], &n, TRUE);
+        aw_complete(w, i, now_ms());
+    } else {
+        EnterCriticalSection(&w->cs);
+        while (!w->done[i]) SleepConditionVariableCS(&w->cv, &w->cs, INFINITE);
+        LeaveCriticalSection(&w->cs);
+        aw_complete(w, i, w->t_done[i]);
+    }
+    w->stall_ms += now_ms() - t0;
+}
+
+// Recolhe a metade i se já terminou, sem bloquear (latência de escrita mais precisa).
+static void aw_poll(AsyncWriter* w, int i){
+    if (!w->pending[i]) return;
+    if (w->mode == IO_OVERLAPPED) {
+        if (HasOverlappedIoCompleted(&w->ov[i])) aw_wait(w, i);
+    } else if (w->done[i]) {
+        aw_wait(w, i);
+    }
+}
+
+void aw_write(AsyncWriter* w, const void* data, size_t len){
+    const char* p = (const char*)data;
+    while (len > 0) {
+        size_t n = AW_BUF - w->fill < len ? AW_BUF - w->fill : len;
+        memcpy(w->buf[w->cur] + w->fill, p, n);
+        w->fill += n; w->logical += n; p += n; len -= n;
+        if (w->fill == AW_BUF) {
+            aw_submit(w, w->cur, AW_BUF);
+            w->cur ^= 1;
+            aw_wait(w, w->cur);     // a outra metade precisa ter sido gravada
+            w->fill = 0;
+        }
+    }
+    aw_poll(w, w->cur ^ 1);
+}
+
+void aw_close(AsyncWriter* w){
+    if (w->fill > 0) {
+        size_t len = w->fill;
+        if (w->direct) {
+            len = (len + AW_SECTOR-1) / AW_SECTOR * AW_SECTOR;
+            memset(w->buf[w->cur] + w->fill, 0, len - w->fill);
+        }
+        aw_submit(w, w->cur, len);
+    }
+    aw_wait(w, 0); aw_wait(w, 1);
+    if (w->prealloc || w->offset != w->logical) {
+        // corta a pré-alocação e o padding do último bloco alinhado. Com NO_BUFFERING o ponteiro
+        // do arquivo só aceita posições alinhadas ao setor; o EOF por handle aceita qualquer uma.
+        FILE_END_OF_FILE_INFO eof;
+        eof.EndOfFile.QuadPart = w->logical;
+        if (!SetFileInformationByHandle(w->file, FileEndOfFileInfo, &eof, sizeof(eof)))
+            printf("Nao foi possivel ajustar o fim do arquivo para %lld bytes (%lu): sobrou padding no final\n",
+                   w->logical, GetLastError());
+    }
+    if (w->mode == IO_THREAD) {
+        EnterCriticalSection(&w->cs);
+        w->stop = 1;
+        WakeAllConditionVariable(&w->cv);
+        LeaveCriticalSection(&w->cs);
+        WaitForSingleObject(w->thread, INFINITE);
+        CloseHandle(w->thread);
+        DeleteCriticalSection(&w->cs);
+    }
+    for (int i=0;i<2;i++){
+        VirtualFree(w->buf[i], 0, MEM_RELEASE);
+        if (w->mode == IO_OVERLAPPED) CloseHandle(w->ov[i].hEvent);
+    }
+    CloseHandle(w->file);
+}
+
+typedef struct Stage {
+    const char *name;
+    LPTHREAD_START_ROUTINE run;
+    void (*fn)(Record*, Work*); // transformação (etapas de processamento)
+    int workers;
+    int cap;                    // capacidade da fila de entrada (0 = captura)
+    Ring in;
+    struct Stage *next;
+    volatile LONG live;         // workers que ainda não viram a poison pill
+    volatile LONG64 busy_us, wait_in_us, wait_out_us;
+} Stage;
+
+Stage stages[MAX_STAGES];
+int n_stages = 0;
+
+int bench = 0;          // sem Sleep/printf: mede só o transporte
+int n_items = N_ITEMS;
+int batch_max = 1;      // capacidade física de cada lote
+int adaptive = 1;       // lote alvo varia entre 1 e batch_max
+
+// Pool de lotes reciclados: a gravação devolve, a captura reaproveita.
+Ring pool;
+Batch *pill;
+
+// Janela de reordenação: a captura só emite lote seq < next_write + window,
+// então o buffer de reordenação nunca precisa de mais de `window` posições.
+HANDLE credits;
+int window;
+Batch **reorder;
+
+float *latencies;       // latência por item (ms), indexada por seq do item
+
+const char *out_path = NULL;    // --saida: grava os registros em arquivo
+int io_mode = IO_OVERLAPPED;
+int io_direct = 0;
+AsyncWriter aw;
+double io_mbps, io_p99, io_max;
+int io_sync, io_writes;         // OVERLAPPED: escritas completadas de forma síncrona / total
+
+static void stage_account(Stage* s, double busy, double win, double wout){
+    InterlockedExchangeAdd64(&s->busy_us, (LONG64)(busy*1000.0));
+    InterlockedExchangeAdd64(&s->wait_in_us, (LONG64)(win*1000.0));
+    InterlockedExchangeAdd64(&s->wait_out_us, (LONG64)(wout*1000.0));
+}
+
+Stage* pipeline_add(const char* name, LPTHREAD_START_ROUTINE run, void (*fn)(Record*, Work*), int workers, int cap){
+    Stage* s = &stages[n_stages];
+    s->name = name; s->run = run; s->fn = fn;
+    s->workers = workers < 1 ? 1 : (workers > MAX_STAGE_WORKERS ? MAX_STAGE_WORKERS : workers);
+    s->cap = cap;
+    s->next = NULL;
+    if (n_stages > 0) stages[n_stages-1].next = s;
+    n_stages++;
+    return s;
+}
+
+void process_item(Record* r, Work* w){
+    if (!bench) {
+        // fluxo por registro: o mesmo item sorteia o mesmo trabalho em qualquer worker
+        Rng rng;
+        rng_seed(&rng, rng_default_seed(), (uint64_t)r->seq);
+        work_ms(w, &rng, 50, 100);
+    }
+    r->val = r->val*2;
+    r->payload[r->seq % RECORD_BYTES] ^= (char)r->val;   // toca o registro no lugar
+}
+
+// Entrega o lote à próxima etapa e ajusta o tamanho alvo:
+// fila seguinte vazia -> lotes menores (latência); put bloqueou -> lotes maiores (vazão).
+static double capture_flush(Stage* s, Batch* b, int* target){
+    int starving = ring_count(&s->next->in) == 0;
+    double t0 = now_ms();
+    ring_put(&s->next->in, b);
+    double waited = now_ms() - t0;
+    if (adaptive) {
+        if (waited > 0.05 && *target < batch_max) *target = *target*2 > batch_max ? batch_max : *target*2;
+        else if (starving && *target > 1) *target /= 2;
+    }
+    return waited;
+}
 
 DWORD WINAPI capture_thread(LPVOID arg){
-    for (int i=0;i<N_ITEMS;i++){
-        Sleep(rand()%50);
-        printf("Captured %d\n", i);
-        ring_put(&q1, i);
+    Stage* s = (Stage*)arg;
+    double busy = 0, wout = 0;
+    int target = adaptive ? 1 : batch_max;
+    TRACE_THREAD("captura", 0);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), (uint64_t)n_items + 1);
+    Work w;
+    work_init(&w, (uint64_t)n_items + 1);
+    int next_batch = 0;
+    Batch* b = NULL;
+    double first = 0;
+    for (int i=0;i<n_items;i++){
+        double t0 = now_ms();
+        if (!bench) {
+            double idle = work_draw_ms(&w, &rng, 0, 50);
+            // o prazo do lote venceria durante o ócio: entrega agora
+            if (b && t0 + idle - first >= BATCH_DEADLINE_MS) { wout += capture_flush(s, b, &target); b = NULL; }
+            work_run_ms(&w, idle);
+            printf("Captured %d\n", i);
+        }
+        double t1 = now_ms();
+        if (!b) {
+            TRACE_BEGIN("espera credito");
+            WaitForSingleObject(credits, INFINITE);
+            TRACE_END("espera credito");
+            b = ring_get(&pool);
+            b->seq = next_batch++; b->n = 0;
+            first = now_ms();
+            wout += first - t1;
+        }
+        // o registro é escrito direto no buffer do pool (sem cópia)
+        Record* r = &b->rec[b->n++];
+        r->seq = i; r->val = i;
+        r->t_capture = now_ms();
+        memset(r->payload, (char)i, RECORD_BYTES);
+        busy += now_ms() - t0;
+        if (b->n >= target || now_ms() - first >= BATCH_DEADLINE_MS) { wout += capture_flush(s, b, &target); b = NULL; }
     }
+    if (b) wout += capture_flush(s, b, &target);
     // poison pill for next stage
-    ring_put(&q1, -1);
+    ring_put(&s->next->in, pill);
+    stage_account(s, busy, 0, wout);
+    work_free(&w);
     return 0;
 }
 
 DWORD WINAPI process_thread(LPVOID arg){
+    Stage* s = (Stage*)arg;
+    double busy = 0, win = 0, wout = 0;
+    Work w;
+    work_init(&w, (uint64_t)(s - stages));
+    TRACE_THREAD(s->name, (int)(s - stages));
     while (1){
-        int v = ring_get(&q1);
-        if (v == -1) {
-            // forward poison pill
-            ring_put(&q2, -1);
+        double t0 = now_ms();
+        Batch* b = ring_get(&s->in);
+        double t1 = now_ms();
+        win += t1 - t0;
+        if (b->seq == POISON) {
+            // repassa a pílula aos irmãos; o último worker a sair a propaga adiante
+            if (InterlockedDecrement(&s->live) > 0) ring_put(&s->in, b);
+            else ring_put(&s->next->in, b);
             break;
         }
-        Sleep(50 + rand()%100);
-        int processed = v*2;
-        printf("Processed %d -> %d\n", v, processed);
-        ring_put(&q2, processed);
+        TRACE_BEGIN(s->name);
+        TRACE_INSTANT("lote", b->n);
+        for (int k=0;k<b->n;k++){
+            int v = b->rec[k].val;
+            s->fn(&b->rec[k], &w);
+            if (!bench) printf("[%s] Processed %d -> %d\n", s->name, v, b->rec[k].val);
+        }
+        TRACE_END(s->name);
+        double t2 = now_ms();
+        ring_put(&s->next->in, b);
+        busy += t2 - t1; wout += now_ms() - t2;
     }
+    stage_account(s, busy, win, wout);
+    work_free(&w);
     return 0;
 }
 
 DWORD WINAPI writer_thread(LPVOID arg){
+    Stage* s = (Stage*)arg;
+    double busy = 0, win = 0;
+    int next_write = 0, written = 0;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), (uint64_t)n_items + 2);
+    Work ww;
+    work_init(&ww, (uint64_t)n_items + 2);
+    TRACE_THREAD("gravacao", 0);
     while (1){
-        int v = ring_get(&q2);
-        if (v == -1) break;
-        // simulate write
-        Sleep(rand()%30);
-        printf("Wrote %d\n", v);
+        double t0 = now_ms();
+        Batch* b = ring_get(&s->in);
+        double t1 = now_ms();
+        win += t1 - t0;
+        if (b->seq == POISON) break;
+        reorder[b->seq % window] = b;
+        // grava tudo o que já está contíguo na ordem de captura
+        while (reorder[next_write % window]) {
+            Batch* w = reorder[next_write % window];
+            reorder[next_write % window] = NULL;
+            for (int k=0;k<w->n;k++){
+                Record* r = &w->rec[k];
+                if (!bench) {
+                    // simulate write
+                    work_ms(&ww, &rng, 0, 30);
+                    printf("Wrote %d (seq %d)\n", r->val, r->seq);
+                }
+                if (out_path) aw_write(&aw, r, sizeof(Record));
+                if (r->seq != written) printf("ERRO: fora de ordem (seq %d, esperado %d)\n", r->seq, written);
+                latencies[r->seq] = (float)(now_ms() - r->t_capture);
+                written++;
+            }
+            next_write++;
+            ring_put(&pool, w);
+            ReleaseSemaphore(credits, 1, NULL);
+        }
+        busy += now_ms() - t1;
     }
+    if (written != n_items) printf("ERRO: gravados %d de %d itens\n", written, n_items);
+    stage_account(s, busy, win, 0);
+    work_free(&ww);
     return 0;
 }
 
-int main(){
-    srand((unsigned)time(NULL));
-    ring_init(&q1, BUF1);
-    ring_init(&q2, BUF2);
+static int cmp_float(const void* a, const void* b){
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
 
-    HANDLE t1 = CreateThread(NULL,0,capture_thread,NULL,0,NULL);
-    HANDLE t2 = CreateThread(NULL,0,process_thread,NULL,0,NULL);
-    HANDLE t3 = CreateThread(NULL,0,writer_thread,NULL,0,NULL);
+// Vazão sustentada e cauda da latência de escrita de uma execução.
+static void aw_stats(AsyncWriter* w, double wall){
+    io_mbps = (w->logical / (1024.0*1024.0)) / (wall / 1000.0);
+    io_sync = w->sync_writes;
+    io_writes = w->nsubmit;
+    io_p99 = io_max = 0;
+    if (w->nw > 0) {
+        qsort(w->wlat, w->nw, sizeof(float), cmp_float);
+        io_p99 = w->wlat[(int)(w->nw*0.99)];
+        io_max = w->wlat[w->nw-1];
+    }
+    free(w->wlat);
+}
+
+// Executa o pipeline uma vez com lotes de até `bmax` registros; retorna o tempo de parede
+// (-1 se não houve memória para os lotes).
+static double run_pipeline(int bmax, int print_stages, double* lat_avg, double* lat_p99){
+    batch_max = bmax;
+    int in_flight = 0;
+    for (int s=0;s<n_stages;s++){
+        Stage* st = &stages[s];
+        st->live = st->workers;
+        st->busy_us = st->wait_in_us = st->wait_out_us = 0;
+        if (st->cap > 0) { ring_init(&st->in, st->cap); in_flight += st->cap + st->workers; }
+    }
+    window = in_flight + 1;
+    credits = CreateSemaphore(NULL, window, window, NULL);
+    reorder = calloc(window, sizeof(Batch*));
+    // +1: o lote que a captura está preenchendo enquanto espera crédito para o próximo
+    ring_init(&pool, window + 1);
+    // lotes grandes somam MB por lote vezes a janela: falha limpa em vez de escrever em NULL
+    Batch** all = calloc(window + 1, sizeof(Batch*));
+    for (int i=0;all && i<window+1;i++){
+        all[i] = malloc(sizeof(Batch) + sizeof(Record)*bmax);
+        if (!all[i]) {
+            printf("Sem memoria para %d lotes de %d registros (%.1f MB cada)\n", window + 1, bmax,
+                   (sizeof(Batch) + sizeof(Record)*(double)bmax) / (1024.0*1024.0));
+            for (int k=0;k<i;k++) free(all[k]);
+            free(all);
+            all = NULL;
+            break;
+        }
+        ring_put(&pool, all[i]);
+    }
+    if (!all) {
+        for (int s=0;s<n_stages;s++) if (stages[s].cap > 0) ring_destroy(&stages[s].in);
+        ring_destroy(&pool);
+        CloseHandle(credits);
+        free(reorder);
+        return -1;
+    }
+    pill = calloc(1, sizeof(Batch));
+    pill->seq = POISON;
+    latencies = malloc(sizeof(float)*n_items);
 
-    WaitForSingleObject(t1, INFINITE);
-    WaitForSingleObject(t2, INFINITE);
-    // ensure writer can finish
-    WaitForSingleObject(t3, INFINITE);
+    if (out_path && !aw_open(&aw, out_path, io_mode, io_direct, (LONGLONG)n_items * sizeof(Record))) out_path = NULL;
+
+    HANDLE ths[MAX_STAGES*MAX_STAGE_WORKERS];
+    int nth = 0;
+    double t0 = now_ms();
+    for (int s=0;s<n_stages;s++)
+        for (int w=0;w<stages[s].workers;w++)
+            ths[nth++] = CreateThread(NULL,0,stages[s].run,&stages[s],0,NULL);
+
+    // WaitForMultipleObjects aceita no máximo MAXIMUM_WAIT_OBJECTS handles por chamada
+    for (int i=0;i<nth;i+=MAXIMUM_WAIT_OBJECTS){
+        int n = nth - i < MAXIMUM_WAIT_OBJECTS ? nth - i : MAXIMUM_WAIT_OBJECTS;
+        WaitForMultipleObjects(n, &ths[i], TRUE, INFINITE);
+    }
+    if (out_path) aw_close(&aw);
+    double wall = now_ms() - t0;
+    if (out_path) {
+        aw_stats(&aw, wall);
+        if (print_stages)
+            printf("Gravação (%s%s): %.1f MB, %.1f MB/s; escrita de %d KB: p99 %.2f ms, max %.2f ms, espera %.0f ms\n",
+                   aw.mode == IO_OVERLAPPED ? "overlapped" : "thread dedicada", aw.direct ? ", sem cache" : "",
+                   aw.logical/(1024.0*1024.0), io_mbps, AW_BUF/1024, io_p99, io_max, aw.stall_ms);
+        if (print_stages && aw.mode == IO_OVERLAPPED)
+            printf("Escritas sincronas: %d de %d (%s)%s\n", io_sync, io_writes,
+                   !aw.prealloc ? "sem pre-alocacao" : aw.valid_data ? "pre-alocado, SetFileValidData" :
+                   "pre-alocado, sem SetFileValidData",
+                   io_sync == io_writes && io_writes ? ": o modo overlapped mediu escrita sincrona" : "");
+    }
+
+    if (print_stages) {
+        printf("%-10s %7s %5s %7s %12s %12s\n", "etapa", "workers", "fila", "util%", "espera-in ms", "espera-out ms");
+        int bottleneck = 0; double best = -1;
+        for (int s=0;s<n_stages;s++){
+            Stage* st = &stages[s];
+            double util = 100.0 * (st->busy_us/1000.0) / (wall * st->workers);
+            if (util > best) { best = util; bottleneck = s; }
+            printf("%-10s %7d %5d %6.1f%% %12.0f %12.0f\n", st->name, st->workers, st->cap,
+                   util, st->wait_in_us/1000.0, st->wait_out_us/1000.0);
+        }
+        printf("Gargalo: %s (%.1f%% de utilização)\n", stages[bottleneck].name, best);
+    }
+
+    double sum = 0;
+    for (int i=0;i<n_items;i++) sum += latencies[i];
+    qsort(latencies, n_items, sizeof(float), cmp_float);
+    *lat_avg = sum / n_items;
+    *lat_p99 = latencies[(int)(n_items*0.99)];
+
+    for (int i=0;i<nth;i++) CloseHandle(ths[i]);
+    for (int s=0;s<n_stages;s++) if (stages[s].cap > 0) ring_destroy(&stages[s].in);
+    for (int i=0;i<window+1;i++) free(all[i]);
+    ring_destroy(&pool);
+    CloseHandle(credits);
+    free(all); free(pill); free(reorder); free(latencies);
+    return wall;
+}
+
+int main(int argc, char** argv){
+    rng_default_seed();
+
+    int sweep = 0;
+    pipeline_add("captura", capture_thread, NULL, 1, 0);
+    for (int i=1;i<argc;i++){
+        if (strcmp(argv[i], "--bench-lotes") == 0) { sweep = 1; continue; }
+        if (strcmp(argv[i], "--lote") == 0 && i+1 < argc) { batch_max = atoi(argv[++i]); continue; }
+        if (strcmp(argv[i], "--saida") == 0 && i+1 < argc) { out_path = argv[++i]; continue; }
+        if (strcmp(argv[i], "--io-thread") == 0) { io_mode = IO_THREAD; continue; }
+        if (strcmp(argv[i], "--direct") == 0) { io_direct = 1; continue; }
+        if (work_arg(argc, argv, &i)) continue;
+        int w = 1, c = BUF1;
+        if (sscanf(argv[i], "%d:%d", &w, &c) < 1 || w < 1 || c < 1) {
+            printf("Etapa invalida '%s' (use W:C)\n", argv[i]); return 1;
+        }
+        if (n_stages == MAX_STAGES-1) {      // reserva a última para a gravação
+            printf("Etapas demais em '%s' (maximo %d de processamento)\n", argv[i], MAX_STAGES-2); return 1;
+        }
+        static char names[MAX_STAGES][16];
+        snprintf(names[n_stages], sizeof(names[0]), "proc%d", n_stages);
+        pipeline_add(names[n_stages], process_thread, process_item, w, c);
+    }
+    if (n_stages == 1) pipeline_add("proc1", process_thread, process_item, 1, BUF1);
+    pipeline_add("gravacao", writer_thread, NULL, 1, BUF2);
+    if (batch_max < 1) batch_max = 1;
+    work_setup();
+    if (batch_max > BENCH_MAX_BATCH) batch_max = BENCH_MAX_BATCH;
+
+    double avg, p99;
+    if (sweep) {
+        bench = 1; adaptive = 0; n_items = BENCH_ITEMS;
+        printf("%d itens de %d bytes, lotes fixos\n", n_items, RECORD_BYTES);
+        printf("%6s %14s %14s %14s", "lote", "itens/s", "lat media us", "lat p99 us");
+        if (out_path) printf(" %10s %14s %11s", "MB/s", "escrita p99 ms", "sincronas");
+        printf("\n");
+        for (int b=1;b<=BENCH_MAX_BATCH;b*=4){
+            double wall = run_pipeline(b, 0, &avg, &p99);
+            if (wall < 0) return 1;
+            printf("%6d %14.0f %14.1f %14.1f", b, n_items / (wall/1000.0), avg*1000.0, p99*1000.0);
+            if (out_path) printf(" %10.1f %14.2f %5d/%-5d", io_mbps, io_p99, io_sync, io_writes);
+            printf("\n");
+        }
+        TRACE_DUMP("ex4_trace.json");
+        return 0;
+    }
 
-    printf("Pipeline finished.\n");
+    double wall = run_pipeline(batch_max, 1, &avg, &p99);
+    if (wall < 0) return 1;
+    printf("Pipeline finished in %.0f ms (latência por item: media %.1f ms, p99 %.1f ms).\n", wall, avg, p99);
+    TRACE_DUMP("ex4_trace.json");
     return 0;
 }
@@ -1,10 +1,34 @@
 // ex5_threadpool.c
 // Pool fixo de N threads (Win32) que processa tarefas CPU-bound: Fibonacci iterativo.
-// Lê tarefas da entrada padrão até EOF (linhas "fib <n>"), enfileira e processa.
+// Lê tarefas da entrada padrão até EOF (linhas "fib <n> [classe [prazo_ms]]"), enfileira e processa.
 // Finaliza corretamente com sinalização.
 // Simples, sem dependências externas.
 //
+// Escalonamento (--politica): fifo, sjf (menor n primeiro), edf (menor prazo absoluto primeiro)
+// ou wfq (fila justa ponderada entre classes, pesos em --pesos). Cada classe tem sua fila de
+// prioridade (heap) com trava própria: submissores e workers de classes diferentes não disputam
+// o mesmo lock. O worker espia sem trava as cabeças publicadas, trava só a classe de menor chave
+// e, se ela esvaziou nesse meio tempo, espia de novo. A ordem entre classes é aproximada sob
+// concorrência; a global qcs fica só para dormir/acordar workers e para o estado do pool.
+//
+// Pool elástico (--elastico MIN:MAX): um thread de controle cria workers quando a fila passa de
+// --profundidade tarefas por worker ou quando a espera média na fila passa de --lat-alvo ms; um
+// worker ocioso por --ocioso ms se aposenta. Entre dois eventos de escala há pelo menos
+// --resfriamento ms (histerese). Linhas "espera <ms>" na entrada pausam a submissão (replay em rajadas).
+//
 // Compilar: cl ex5_threadpool.c  OR  gcc -o ex5_threadpool.exe ex5_threadpool.c
+// Uso:      ex5_threadpool.exe [N] [--politica fifo|sjf|edf|wfq] [--pesos w0,w1,...] < tarefas.txt
+//           ex5_threadpool.exe --elastico MIN:MAX [--ocioso ms] [--lat-alvo ms] [--profundidade k] [--resfriamento ms] < tarefas.txt
+//           ex5_threadpool.exe --elastico MIN:MAX --bench-elastico < rajadas.txt   (compara com pools fixos)
+//           ex5_threadpool.exe [N] --lote B [--quieto] < tarefas.txt   (ingestão em blocos, B tarefas por lock)
+//           ex5_threadpool.exe [N] --demo-futuros | --bench-drenagem
+//
+// API de submissão: submit() devolve um Future com future_wait/future_wait_timeout, future_then
+// (continuação executada por quem completa a tarefa) e future_cancel (só tarefas ainda na fila).
+// wait_all() é um latch: contador de tarefas pendentes + variável de condição, sem polling.
+//
+// Compilado com -DTRACE grava ex5_trace.json: ociosidade e tarefas por worker, tamanho da fila e
+// número de workers vivos (ver trace.h).
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
@@ -14,20 +38,123 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <float.h>
+#include "trace.h"
+#include "cache.h"
+
+#define MAX_CLASSES 8
+#define MAX_WORKERS 64
+#define SCALER_TICK_MS 5
+#define INGEST_BLOCK (1 << 20)  // leitura da entrada em blocos de 1 MB
+
+typedef enum { POL_FIFO, POL_SJF, POL_EDF, POL_WFQ } Policy;
+const char* policy_names[] = { "fifo", "sjf", "edf", "wfq" };
+
+enum { F_PENDENTE, F_EXECUTANDO, F_PRONTO, F_CANCELADO };
+
+typedef struct Future Future;
+typedef void (*FutureFn)(Future* f, void* arg);
+struct Future {
+    volatile LONG state;        // F_PENDENTE -> F_EXECUTANDO -> F_PRONTO, ou F_PENDENTE -> F_CANCELADO
+    volatile LONG refs;         // pool + chamador; o último future_release libera
+    long long id;
+    unsigned long long result;
+    FutureFn then; void* then_arg;
+    CONDITION_VARIABLE cv;      // espera com fcs
+};
 
 typedef struct Task {
     long long id;
+    Future* fut;            // NULL: submissão sem future (stdin)
     long long n;
-    struct Task* next;
+    int cls;                // classe do submissor (0..MAX_CLASSES-1)
+    double t_submit;        // ms
+    double deadline;        // prazo absoluto em ms; 0 = sem prazo
+    double key;             // prioridade na fila: menor sai primeiro (empate: menor id)
+    double start_tag;       // wfq: tempo virtual de início
 } Task;
 
-CRITICAL_SECTION qcs;
+// Heap binário de tarefas (um por classe).
+typedef struct { Task** a; int n, cap; } Heap;
+
+// Fila de uma classe: heap e trava na mesma linha, classes vizinhas em linhas separadas.
+// depth/head_key/head_id são republicados a cada push/pop (com a trava) para a espiada sem trava.
+typedef struct {
+    CACHE_ALIGN SRWLOCK lock;
+    Heap h;
+    volatile LONG depth;
+    volatile double head_key;
+    volatile long long head_id;
+    double last_finish;         // wfq: tag de término da última tarefa da classe
+} ClassQueue;
+
+CRITICAL_SECTION qcs;               // estado do pool e sono dos workers (não protege os heaps)
 CONDITION_VARIABLE qcv;
-Task* qhead=NULL;
-Task* qtail=NULL;
+ClassQueue queues[MAX_CLASSES];
+volatile LONG queued = 0;           // tarefas publicadas e ainda não retiradas (Interlocked)
+volatile LONG sleepers = 0;         // workers que vão dormir em qcv: o submissor só entra em qcs se > 0
 int shutdown_flag = 0;
 LONG enqueued=0, processed=0;
 
+Policy policy = POL_FIFO;
+double weights[MAX_CLASSES] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+volatile double vtime = 0;          // wfq: tempo virtual do sistema (só avança; corrida benigna)
+
+CRITICAL_SECTION fcs;                // estado de espera/continuação dos futures
+CONDITION_VARIABLE idle_cv;         // wait_all: sinalizada quando outstanding chega a zero (com qcs)
+volatile LONG outstanding = 0;      // submetidas e ainda não concluídas/canceladas
+int drain_polling = 0;              // pool_stop com o laço antigo de Sleep(50), para comparação
+double last_done_ms = 0, drain_lat_ms = 0;
+
+// Latências por classe (submissão -> término), coletadas sob scs.
+typedef struct { double* lat; int n, cap; long with_deadline, missed; } ClassStats;
+CRITICAL_SECTION scs;
+ClassStats cstats[MAX_CLASSES];
+
+// Pool elástico: workers ocupam slots; tudo abaixo é protegido por qcs.
+int elastic = 0, min_workers = 1, max_workers = 8;
+DWORD idle_ms = 200;            // ocioso por esse tempo -> aposenta (se acima do mínimo)
+double lat_target_ms = 50;      // espera média na fila acima disso -> cresce
+int depth_per_worker = 2;       // fila acima de live*k -> cresce
+double cooldown_ms = 20;        // intervalo mínimo entre eventos de escala
+HANDLE worker_th[MAX_WORKERS];
+int slot_busy[MAX_WORKERS];
+int live_workers = 0, peak_workers = 0;
+volatile double wait_ewma = 0;  // espera na fila (ms), média móvel exponencial (heurística, sem trava)
+double t_start, last_scale_ms, last_live_change, worker_ms;
+typedef struct { double t; int live, queued; const char* why; } ScaleEvent;
+ScaleEvent* scale_log = NULL;
+int scale_n = 0, scale_cap = 0;
+HANDLE scaler_th = NULL;
+int quiet = 0;
+long long next_id = 1;
+
+double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
+
+int task_before(const Task* a, const Task* b){
+    return a->key < b->key || (a->key == b->key && a->id < b->id);
+}
+void heap_push(Heap* h, Task* t){
+    if (h->n == h->cap) { h->cap = h->cap ? h->cap*2 : 64; h->a = realloc(h->a, sizeof(Task*)*h->cap); }
+    int i = h->n++;
+    while (i > 0 && task_before(t, h->a[(i-1)/2])) { h->a[i] = h->a[(i-1)/2]; i = (i-1)/2; }
+    h->a[i] = t;
+}
+Task* heap_pop(Heap* h){
+    Task* top = h->a[0];
+    Task* last = h->a[--h->n];
+    int i = 0;
+    for(;;){
+        int c = 2*i+1;
+        if (c >= h->n) break;
+        if (c+1 < h->n && task_before(h->a[c+1], h->a[c])) c++;
+        if (!task_before(h->a[c], last)) break;
+        h->a[i] = h->a[c]; i = c;
+    }
+    if (h->n) h->a[i] = last;
+    return top;
+}
+
 unsigned long long fib_iter(long long n){
     if (n<=0) return 0;
     if (n==1) return 1;
@@ -36,82 +163,691 @@ unsigned long long fib_iter(long long n){
     return b;
 }
 
-void enqueue(Task* t){
+// Custo previsto: fib_iter é linear em n.
+double task_cost(const Task* t){ return t->n > 1 ? (double)t->n : 1.0; }
+
+// Com a trava da classe: republica a cabeça para a espiada sem trava do dequeue.
+void publish_head(ClassQueue* q){
+    if (q->h.n) { q->head_key = q->h.a[0]->key; q->head_id = q->h.a[0]->id; }
+    q->depth = q->h.n;
+}
+
+// Com a trava da classe: calcula a chave de prioridade conforme a política e insere no heap.
+void push_task(ClassQueue* q, Task* t){
+    switch (policy){
+    case POL_FIFO: t->key = (double)t->id; break;
+    case POL_SJF:  t->key = task_cost(t); break;
+    case POL_EDF:  t->key = t->deadline > 0 ? t->deadline : DBL_MAX; break;
+    case POL_WFQ: {
+        // tag de término = max(V, término anterior da classe) + custo/peso
+        double v = vtime;
+        t->start_tag = v > q->last_finish ? v : q->last_finish;
+        t->key = q->last_finish = t->start_tag + task_cost(t) / weights[t->cls];
+        break;
+    }
+    }
+    heap_push(&q->h, t);
+}
+
+// Depois de inserir n tarefas: conta na fila e acorda workers. O Interlocked em queued e o de
+// sleepers no worker são barreiras completas: ou o worker vê a tarefa antes de dormir, ou o
+// submissor vê o worker dormindo e passa por qcs para acordá-lo.
+void publish_work(int n){
+    LONG depth = InterlockedExchangeAdd(&queued, n) + n;
+    TRACE_COUNTER("fila", depth);
+    if (!sleepers) return;
     EnterCriticalSection(&qcs);
-    t->next = NULL;
-    if (!qtail) qhead = qtail = t;
-    else { qtail->next = t; qtail = t; }
-    WakeConditionVariable(&qcv);
+    if (n == 1) WakeConditionVariable(&qcv); else WakeAllConditionVariable(&qcv);
     LeaveCriticalSection(&qcs);
 }
+
+void enqueue(Task* t){
+    ClassQueue* q = &queues[t->cls];
+    InterlockedIncrement(&outstanding);
+    AcquireSRWLockExclusive(&q->lock);
+    push_task(q, t);
+    publish_head(q);
+    ReleaseSRWLockExclusive(&q->lock);
+    publish_work(1);
+}
+
+// Um lote inteiro com uma aquisição de trava por classe presente no lote (a ordem dentro
+// de cada classe é preservada).
+void enqueue_batch(Task** ts, int n){
+    InterlockedExchangeAdd(&outstanding, n);
+    TRACE_INSTANT("lote", n);
+    unsigned present = 0;
+    for (int i=0;i<n;i++) present |= 1u << ts[i]->cls;
+    for (int c=0;c<MAX_CLASSES;c++){
+        if (!(present & (1u << c))) continue;
+        ClassQueue* q = &queues[c];
+        AcquireSRWLockExclusive(&q->lock);
+        for (int i=0;i<n;i++) if (ts[i]->cls == c) push_task(q, ts[i]);
+        publish_head(q);
+        ReleaseSRWLockExclusive(&q->lock);
+    }
+    publish_work(n);
+}
+
+// Sem qcs. Escolhe a classe pela cabeça publicada (leitura sem trava: pode estar um passo
+// atrasada) e trava só ela; NULL quando não há nada visível.
 Task* dequeue(){
-    EnterCriticalSection(&qcs);
-    Task* t = qhead;
-    if (t){
-        qhead = t->next;
-        if (!qhead) qtail = NULL;
+    while (queued > 0) {
+        int best = -1;
+        double bkey = 0; long long bid = 0;
+        for (int c=0;c<MAX_CLASSES;c++){
+            if (!queues[c].depth) continue;
+            double k = queues[c].head_key; long long id = queues[c].head_id;
+            if (best < 0 || k < bkey || (k == bkey && id < bid)) { best = c; bkey = k; bid = id; }
+        }
+        if (best < 0) return NULL;
+        ClassQueue* q = &queues[best];
+        AcquireSRWLockExclusive(&q->lock);
+        Task* t = q->h.n ? heap_pop(&q->h) : NULL;
+        publish_head(q);
+        ReleaseSRWLockExclusive(&q->lock);
+        if (!t) continue;           // outro worker esvaziou a classe: espia de novo
+        LONG depth = InterlockedDecrement(&queued);
+        TRACE_COUNTER("fila", depth);
+        if (policy == POL_WFQ && t->start_tag > vtime) vtime = t->start_tag;
+        wait_ewma = 0.8 * wait_ewma + 0.2 * (now_ms() - t->t_submit);
+        return t;
     }
+    return NULL;
+}
+
+void record_latency(const Task* t, double done){
+    ClassStats* cs = &cstats[t->cls];
+    EnterCriticalSection(&scs);
+    if (cs->n == cs->cap) { cs->cap = cs->cap ? cs->cap*2 : 256; cs->lat = realloc(cs->lat, sizeof(double)*cs->cap); }
+    cs->lat[cs->n++] = done - t->t_submit;
+    if (t->deadline > 0) { cs->with_deadline++; if (done > t->deadline) cs->missed++; }
+    if (done > last_done_ms) last_done_ms = done;
+    LeaveCriticalSection(&scs);
+}
+
+// ---------------------------- futures e latch ----------------------------
+void future_release(Future* f){
+    if (InterlockedDecrement(&f->refs) == 0) free(f);
+}
+
+// Estado final (F_PRONTO ou F_CANCELADO): acorda quem espera e roda a continuação, se houver.
+void future_complete(Future* f, LONG state){
+    EnterCriticalSection(&fcs);
+    f->state = state;
+    FutureFn fn = f->then;
+    f->then = NULL;
+    WakeAllConditionVariable(&f->cv);
+    LeaveCriticalSection(&fcs);
+    if (fn) fn(f, f->then_arg);
+}
+
+int future_done(Future* f){ return f->state == F_PRONTO || f->state == F_CANCELADO; }
+
+// Espera até ms milissegundos (INFINITE = sem limite); devolve 1 se o future terminou.
+int future_wait_timeout(Future* f, DWORD ms){
+    double limit = now_ms() + ms;
+    EnterCriticalSection(&fcs);
+    while (!future_done(f)) {
+        DWORD left = INFINITE;
+        if (ms != INFINITE) {
+            double r = limit - now_ms();
+            if (r <= 0) break;
+            left = (DWORD)r + 1;
+        }
+        SleepConditionVariableCS(&f->cv, &fcs, left);
+    }
+    int done = future_done(f);
+    LeaveCriticalSection(&fcs);
+    return done;
+}
+void future_wait(Future* f){ future_wait_timeout(f, INFINITE); }
+
+// Registra a continuação; se o future já terminou, roda agora na thread chamadora.
+void future_then(Future* f, FutureFn fn, void* arg){
+    EnterCriticalSection(&fcs);
+    if (!future_done(f)) { f->then = fn; f->then_arg = arg; fn = NULL; }
+    LeaveCriticalSection(&fcs);
+    if (fn) fn(f, arg);
+}
+
+void task_done(){
+    if (InterlockedDecrement(&outstanding) == 0) {
+        EnterCriticalSection(&qcs);
+        WakeAllConditionVariable(&idle_cv);
+        LeaveCriticalSection(&qcs);
+    }
+}
+
+// Cancela uma tarefa que ainda não começou. A tarefa sai da fila de forma preguiçosa:
+// o worker que a retirar só a descarta.
+int future_cancel(Future* f){
+    if (InterlockedCompareExchange(&f->state, F_CANCELADO, F_PENDENTE) != F_PENDENTE) return 0;
+    future_complete(f, F_CANCELADO);
+    task_done();
+    return 1;
+}
+
+// Latch: bloqueia até todas as tarefas submetidas terminarem (ou serem canceladas).
+void wait_all(){
+    EnterCriticalSection(&qcs);
+    while (outstanding) SleepConditionVariableCS(&idle_cv, &qcs, INFINITE);
     LeaveCriticalSection(&qcs);
-    return t;
+}
+
+int cmp_double(const void* a, const void* b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+double percentile(const double* v, int n, double q){
+    int i = (int)(q * (n - 1) + 0.5);
+    return v[i];
+}
+void print_class_stats(){
+    printf("Politica=%s\n", policy_names[policy]);
+    printf("%6s %8s %10s %10s %10s %10s %7s %9s\n", "classe", "tarefas", "p50 ms", "p90 ms", "p99 ms", "max ms", "prazos", "perdidos");
+    for (int c=0;c<MAX_CLASSES;c++){
+        ClassStats* cs = &cstats[c];
+        if (!cs->n) continue;
+        qsort(cs->lat, cs->n, sizeof(double), cmp_double);
+        printf("%6d %8d %10.2f %10.2f %10.2f %10.2f %7ld %8.1f%%\n", c, cs->n,
+               percentile(cs->lat, cs->n, 0.50), percentile(cs->lat, cs->n, 0.90),
+               percentile(cs->lat, cs->n, 0.99), cs->lat[cs->n-1], cs->with_deadline,
+               cs->with_deadline ? 100.0 * cs->missed / cs->with_deadline : 0.0);
+        free(cs->lat);
+    }
+}
+
+// Chamada com qcs. why == NULL: mudança sem registro (partida/parada do pool).
+void live_change(int delta, const char* why){
+    double t = now_ms();
+    worker_ms += live_workers * (t - last_live_change);
+    last_live_change = t;
+    live_workers += delta;
+    TRACE_COUNTER("workers", live_workers);
+    if (live_workers > peak_workers) peak_workers = live_workers;
+    if (!why) return;
+    last_scale_ms = t;
+    if (scale_n == scale_cap) { scale_cap = scale_cap ? scale_cap*2 : 64; scale_log = realloc(scale_log, sizeof(ScaleEvent)*scale_cap); }
+    ScaleEvent e = { t - t_start, live_workers, queued, why };
+    scale_log[scale_n++] = e;
 }
 
 DWORD WINAPI worker(LPVOID arg){
     int id = (int)(intptr_t)arg;
+    TRACE_THREAD("worker", id);
     for(;;){
-        EnterCriticalSection(&qcs);
-        while (!qhead && !shutdown_flag) SleepConditionVariableCS(&qcv,&qcs,INFINITE);
-        if (!qhead && shutdown_flag) { LeaveCriticalSection(&qcs); break; }
         Task* t = dequeue();
-        LeaveCriticalSection(&qcs);
-        if (t){
-            unsigned long long res = fib_iter(t->n);
+        if (!t) {
+            // nada visível: dorme em qcv (sleepers antes de reler queued, ver publish_work)
             EnterCriticalSection(&qcs);
-            printf("[W%d] id=%lld fib(%lld)=%llu\n", id, t->id, t->n, res);
+            InterlockedIncrement(&sleepers);
+            int idle = !queued && !shutdown_flag;
+            if (idle) TRACE_BEGIN("ocioso");
+            while (!queued && !shutdown_flag) {
+                if (!SleepConditionVariableCS(&qcv,&qcs, elastic ? idle_ms : INFINITE)
+                    && !queued && !shutdown_flag && live_workers > min_workers
+                    && now_ms() - last_scale_ms >= cooldown_ms) {
+                    InterlockedDecrement(&sleepers);
+                    slot_busy[id] = 0;
+                    live_change(-1, "ocioso");
+                    LeaveCriticalSection(&qcs);
+                    TRACE_END("ocioso");
+                    return 0;
+                }
+            }
+            InterlockedDecrement(&sleepers);
+            if (idle) TRACE_END("ocioso");
+            int done = !queued && shutdown_flag;
             LeaveCriticalSection(&qcs);
-            InterlockedIncrement(&processed);
+            if (done) break;
+            continue;
+        }
+        if (t->fut && InterlockedCompareExchange(&t->fut->state, F_EXECUTANDO, F_PENDENTE) != F_PENDENTE) {
+            future_release(t->fut);     // cancelada enquanto estava na fila
             free(t);
+            continue;
+        }
+        TRACE_BEGIN("tarefa");
+        unsigned long long res = fib_iter(t->n);
+        record_latency(t, now_ms());
+        TRACE_END("tarefa");
+        if (!quiet) {
+            EnterCriticalSection(&qcs);
+            printf("[W%d] id=%lld fib(%lld)=%llu\n", id, t->id, t->n, res);
+            LeaveCriticalSection(&qcs);
         }
+        InterlockedIncrement(&processed);
+        if (t->fut) {
+            t->fut->result = res;
+            future_complete(t->fut, F_PRONTO);
+            future_release(t->fut);
+        }
+        task_done();
+        free(t);
     }
     return 0;
 }
 
-int main(int argc, char** argv){
-    InitializeCriticalSection(&qcs);
-    InitializeConditionVariable(&qcv);
-
-    int nthreads = 4;
-    if (argc>1) nthreads = atoi(argv[1]);
-    HANDLE *ths = malloc(sizeof(HANDLE)*nthreads);
-    for (int i=0;i<nthreads;i++) ths[i]=CreateThread(NULL,0,worker,(LPVOID)(intptr_t)i,0,NULL);
+// Chamada com qcs. O handle de um worker aposentado é fechado quando o slot é reaproveitado.
+int spawn_worker(const char* why){
+    for (int i=0;i<MAX_WORKERS;i++){
+        if (slot_busy[i]) continue;
+        if (worker_th[i]) CloseHandle(worker_th[i]);
+        slot_busy[i] = 1;
+        worker_th[i] = CreateThread(NULL,0,worker,(LPVOID)(intptr_t)i,0,NULL);
+        live_change(+1, why);
+        return 1;
+    }
+    return 0;
+}
 
-    // read stdin
-    char line[128];
-    long long next_id=1;
-    while (fgets(line,sizeof(line),stdin)){
-        char cmd[16]; long long n;
-        if (sscanf(line,"%15s %lld",cmd,&n)==2 && strcmp(cmd,"fib")==0){
-            Task* t = malloc(sizeof(Task));
-            t->id = next_id++; t->n = n; t->next = NULL;
-            enqueue(t);
-            InterlockedIncrement(&enqueued);
-        } else {
-            printf("Invalid. Use: fib <n>\n");
+DWORD WINAPI scaler(LPVOID arg){
+    (void)arg;
+    for(;;){
+        Sleep(SCALER_TICK_MS);
+        EnterCriticalSection(&qcs);
+        if (shutdown_flag) { LeaveCriticalSection(&qcs); break; }
+        if (live_workers < max_workers && now_ms() - last_scale_ms >= cooldown_ms) {
+            if (queued > depth_per_worker * live_workers) {
+                // cresce de uma vez até a profundidade alvo (limitado a max_workers)
+                int want = (queued + depth_per_worker - 1) / depth_per_worker;
+                if (want > max_workers) want = max_workers;
+                while (live_workers < want && spawn_worker("fila"));
+            } else if (queued > 0 && wait_ewma > lat_target_ms) {
+                spawn_worker("latencia");
+            }
         }
+        LeaveCriticalSection(&qcs);
     }
+    return 0;
+}
 
-    // shutdown: wait until queue empty then signal shutdown
-    for(;;){
+void pool_start(int n){
+    EnterCriticalSection(&qcs);
+    shutdown_flag = 0;
+    enqueued = processed = 0;
+    next_id = 1;
+    vtime = 0;
+    for (int c=0;c<MAX_CLASSES;c++) queues[c].last_finish = 0;
+    live_workers = peak_workers = 0; worker_ms = 0; wait_ewma = 0; scale_n = 0;
+    last_done_ms = 0;
+    t_start = last_live_change = now_ms();
+    last_scale_ms = t_start - cooldown_ms;
+    for (int i=0;i<n;i++) spawn_worker(NULL);
+    LeaveCriticalSection(&qcs);
+    if (elastic) scaler_th = CreateThread(NULL,0,scaler,NULL,0,NULL);
+}
+
+// Espera todas as tarefas, encerra os workers e devolve o tempo total (ms) desde pool_start.
+// drain_lat_ms = do término da última tarefa até o pool estar encerrado.
+double pool_stop(){
+    if (drain_polling) {
+        // laço original: espera a fila esvaziar consultando a cada 50 ms
+        for(;;){
+            EnterCriticalSection(&qcs);
+            int empty = (queued==0);
+            if (empty){ shutdown_flag = 1; WakeAllConditionVariable(&qcv); LeaveCriticalSection(&qcs); break; }
+            LeaveCriticalSection(&qcs);
+            Sleep(50);
+        }
+    } else {
+        wait_all();
         EnterCriticalSection(&qcs);
-        int empty = (qhead==NULL);
-        if (empty){ shutdown_flag = 1; WakeAllConditionVariable(&qcv); LeaveCriticalSection(&qcs); break; }
+        shutdown_flag = 1;
+        WakeAllConditionVariable(&qcv);
         LeaveCriticalSection(&qcs);
-        Sleep(50);
     }
+    if (scaler_th) { WaitForSingleObject(scaler_th, INFINITE); CloseHandle(scaler_th); scaler_th = NULL; }
+    for (int i=0;i<MAX_WORKERS;i++){
+        if (!worker_th[i]) continue;
+        WaitForSingleObject(worker_th[i], INFINITE);
+        CloseHandle(worker_th[i]);
+        worker_th[i] = NULL; slot_busy[i] = 0;
+    }
+    EnterCriticalSection(&qcs);
+    live_change(-live_workers, NULL);
+    LeaveCriticalSection(&qcs);
+    double t = now_ms();
+    drain_lat_ms = last_done_ms > 0 ? t - last_done_ms : 0;
+    return t - t_start;
+}
+
+Task* new_task(long long n, int cls){
+    Task* t = malloc(sizeof(Task));
+    t->id = next_id++; t->n = n; t->cls = cls; t->fut = NULL;
+    return t;
+}
+
+// Submete fib(n) e devolve um future (o chamador deve chamar future_release).
+// then != NULL registra a continuação antes da tarefa entrar na fila.
+Future* submit(long long n, int cls, double prazo_ms, FutureFn then, void* arg){
+    Future* f = calloc(1, sizeof(Future));
+    InitializeConditionVariable(&f->cv);
+    f->refs = 2;
+    f->then = then; f->then_arg = arg;
+    Task* t = new_task(n, cls);
+    f->id = t->id;
+    t->fut = f;
+    t->t_submit = now_ms();
+    t->deadline = prazo_ms > 0 ? t->t_submit + prazo_ms : 0;
+    enqueue(t);
+    InterlockedIncrement(&enqueued);
+    return f;
+}
+
+// Uma linha de entrada: "fib <n> [classe [prazo_ms]]" ou "espera <ms>".
+void submit_line(const char* line){
+    char cmd[16]; long long n; int cls = 0; double prazo = 0;
+    int k = sscanf(line,"%15s %lld %d %lf",cmd,&n,&cls,&prazo);
+    if (k>=2 && strcmp(cmd,"fib")==0){
+        if (cls < 0 || cls >= MAX_CLASSES) cls = 0;
+        Task* t = new_task(n, cls);
+        t->t_submit = now_ms();
+        t->deadline = prazo > 0 ? t->t_submit + prazo : 0;
+        enqueue(t);
+        InterlockedIncrement(&enqueued);
+    } else if (k==2 && strcmp(cmd,"espera")==0){
+        Sleep((DWORD)n);
+    } else {
+        printf("Invalid. Use: fib <n> [classe [prazo_ms]]  |  espera <ms>\n");
+    }
+}
+
+// ---------- ingestão em blocos: tokenizador no próprio buffer, sem sscanf ----------
+const char* skip_ws(const char* p, const char* end){
+    while (p < end && (*p==' ' || *p=='\t' || *p=='\r')) p++;
+    return p;
+}
+// Inteiro com sinal opcional; *ok = 0 se não há dígitos.
+long long parse_ll(const char** pp, const char* end, int* ok){
+    const char* p = skip_ws(*pp, end);
+    int neg = 0;
+    if (p < end && (*p=='-' || *p=='+')) { neg = (*p=='-'); p++; }
+    const char* d = p;
+    long long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') { v = v*10 + (*p - '0'); p++; }
+    *ok = p > d;
+    *pp = p;
+    return neg ? -v : v;
+}
+int word_is(const char** pp, const char* end, const char* w){
+    const char* p = skip_ws(*pp, end);
+    size_t n = strlen(w);
+    if ((size_t)(end - p) < n || memcmp(p, w, n) || (p + n < end && p[n] != ' ' && p[n] != '\t' && p[n] != '\r')) return 0;
+    *pp = p + n;
+    return 1;
+}
+
+// Interpreta [p, end): 1 = tarefa (n, cls, prazo), 2 = espera (*n ms), 0 = inválida.
+int parse_line(const char* p, const char* end, long long* n, int* cls, double* prazo){
+    int ok;
+    *cls = 0; *prazo = 0;
+    if (word_is(&p, end, "espera")) { *n = parse_ll(&p, end, &ok); return ok ? 2 : 0; }
+    if (!word_is(&p, end, "fib")) return 0;
+    *n = parse_ll(&p, end, &ok);
+    if (!ok) return 0;
+    long long c = parse_ll(&p, end, &ok);
+    if (!ok) return 1;
+    *cls = (c < 0 || c >= MAX_CLASSES) ? 0 : (int)c;
+    p = skip_ws(p, end);
+    int neg = p < end && *p == '-';     // o sinal vale para a fração também ("-0.5" < 0: sem prazo)
+    long long ms = parse_ll(&p, end, &ok);
+    if (!ok) return 1;
+    double frac = 0, scale = 0.1;
+    if (p < end && *p == '.') for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale *= 0.1) frac += (*p - '0') * scale;
+    *prazo = neg ? ms - frac : ms + frac;
+    return 1;
+}
+
+// Carimba o lote (submissão e prazo absoluto) e o entrega ao pool.
+void flush_batch(Task** pend, int* np){
+    if (!*np) return;
+    double t = now_ms();
+    for (int i=0;i<*np;i++){
+        pend[i]->t_submit = t;
+        pend[i]->deadline = pend[i]->deadline > 0 ? t + pend[i]->deadline : 0;
+    }
+    enqueue_batch(pend, *np);
+    InterlockedExchangeAdd(&enqueued, *np);
+    *np = 0;
+}
+
+// Lê stdin em blocos de INGEST_BLOCK (o resto de linha vai para o bloco seguinte) e submete
+// lotes de até 'batch' tarefas. Devolve o número de linhas lidas.
+long long bulk_ingest(int batch){
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    char* buf = malloc(INGEST_BLOCK);
+    Task** pend = malloc(sizeof(Task*)*batch);
+    int np = 0, eof = 0;
+    size_t carry = 0;
+    long long lines = 0;
+    while (!eof){
+        flush_batch(pend, &np);     // não segura tarefas enquanto bloqueia na leitura
+        DWORD got = 0;
+        if (!ReadFile(in, buf + carry, (DWORD)(INGEST_BLOCK - carry), &got, NULL) || got == 0) eof = 1;
+        const char *p = buf, *end = buf + carry + got;
+        while (p < end){
+            const char* eol = memchr(p, '\n', end - p);
+            if (!eol && !eof) break;            // linha incompleta: espera o próximo bloco
+            if (!eol) eol = end;
+            lines++;
+            long long n; int cls; double prazo;
+            int kind = parse_line(p, eol, &n, &cls, &prazo);
+            if (kind == 1){
+                Task* t = new_task(n, cls);
+                t->deadline = prazo;            // relativo até o flush
+                pend[np++] = t;
+                if (np == batch) flush_batch(pend, &np);
+            } else if (kind == 2){
+                flush_batch(pend, &np);
+                Sleep((DWORD)n);
+            } else {
+                printf("Invalid. Use: fib <n> [classe [prazo_ms]]  |  espera <ms>\n");
+            }
+            p = eol + 1;
+        }
+        if (p > end) p = end;
+        carry = end - p;
+        if (carry == INGEST_BLOCK) { printf("Linha maior que %d bytes descartada\n", INGEST_BLOCK); carry = 0; }
+        memmove(buf, p, carry);
+    }
+    flush_batch(pend, &np);
+    free(pend); free(buf);
+    return lines;
+}
+
+void print_scale_log(double total_ms){
+    printf("Eventos de escala (%d):\n", scale_n);
+    for (int i=0;i<scale_n;i++)
+        printf("  %9.1f ms  %-8s -> %2d workers (fila=%d)\n", scale_log[i].t, scale_log[i].why, scale_log[i].live, scale_log[i].queued);
+    printf("Workers: pico=%d medio=%.2f (worker-s=%.2f)\n", peak_workers, worker_ms / total_ms, worker_ms / 1000.0);
+}
+
+// Percentis de latência de todas as classes juntas; esvazia as estatísticas para a próxima rodada.
+void latency_summary(double* p50, double* p99, double* mx){
+    int n = 0;
+    for (int c=0;c<MAX_CLASSES;c++) n += cstats[c].n;
+    double* all = malloc(sizeof(double)*(n ? n : 1));
+    n = 0;
+    for (int c=0;c<MAX_CLASSES;c++){
+        memcpy(all + n, cstats[c].lat, sizeof(double)*cstats[c].n);
+        n += cstats[c].n;
+        free(cstats[c].lat);
+        memset(&cstats[c], 0, sizeof(ClassStats));
+    }
+    qsort(all, n, sizeof(double), cmp_double);
+    *p50 = n ? percentile(all, n, 0.50) : 0;
+    *p99 = n ? percentile(all, n, 0.99) : 0;
+    *mx = n ? all[n-1] : 0;
+    free(all);
+}
+
+// Repete o mesmo replay da entrada com pools fixos (MIN e MAX) e com o pool elástico.
+void bench_elastic(){
+    char** lines = NULL;
+    int nl = 0, cap = 0;
+    char line[128];
+    while (fgets(line,sizeof(line),stdin)){
+        if (nl == cap) { cap = cap ? cap*2 : 1024; lines = realloc(lines, sizeof(char*)*cap); }
+        lines[nl++] = strdup(line);
+    }
+    quiet = 1;
+    printf("%-14s %10s %9s %9s %9s %6s %9s %7s\n", "pool", "tempo ms", "p50 ms", "p99 ms", "max ms", "pico", "worker-s", "escalas");
+    for (int cfg=0;cfg<3;cfg++){
+        int n = cfg == 0 ? min_workers : cfg == 1 ? max_workers : min_workers;
+        elastic = (cfg == 2);
+        pool_start(n);
+        for (int i=0;i<nl;i++) submit_line(lines[i]);
+        double total = pool_stop();
+        double p50, p99, mx;
+        latency_summary(&p50, &p99, &mx);
+        char name[32];
+        if (elastic) snprintf(name, sizeof(name), "elastico %d:%d", min_workers, max_workers);
+        else snprintf(name, sizeof(name), "fixo %d", n);
+        printf("%-14s %10.1f %9.2f %9.2f %9.2f %6d %9.2f %7d\n", name, total, p50, p99, mx, peak_workers, worker_ms / 1000.0, scale_n);
+    }
+    for (int i=0;i<nl;i++) free(lines[i]);
+    free(lines);
+}
 
-    WaitForMultipleObjects(nthreads, ths, TRUE, INFINITE);
-    for (int i=0;i<nthreads;i++) CloseHandle(ths[i]);
+void print_done(Future* f, void* arg){
+    printf("  [%s] id=%lld %s resultado=%llu\n", (const char*)arg, f->id,
+           f->state == F_PRONTO ? "pronto" : "cancelado", f->result);
+}
+
+// Exercita a API: espera com timeout, continuação, cancelamento de tarefas enfileiradas e wait_all.
+void demo_futures(int nthreads){
+    quiet = 1;
+    pool_start(nthreads);
+    Future* big[16];
+    int nbig = nthreads + 4;
+    if (nbig > 16) nbig = 16;
+    for (int i=0;i<nbig;i++) big[i] = submit(300000000, 0, 0, NULL, NULL);
+    printf("future %lld pronto em 1 ms? %s\n", big[0]->id, future_wait_timeout(big[0], 1) ? "sim" : "nao");
+    Future* small = submit(90, 1, 0, NULL, NULL);
+    future_then(small, print_done, "continuacao");
+    int cancelled = 0;
+    for (int i=nbig-1;i>=0;i--) cancelled += future_cancel(big[i]);
+    printf("%d tarefas canceladas ainda na fila\n", cancelled);
+    future_wait(small);
+    double t0 = now_ms();
+    wait_all();
+    printf("wait_all liberou em %.1f ms\n", now_ms() - t0);
+    for (int i=0;i<nbig;i++){
+        if (big[i]->state == F_PRONTO) print_done(big[i], "espera");
+        future_release(big[i]);
+    }
+    future_release(small);
+    pool_stop();
     printf("Enqueued=%ld Processed=%ld\n", enqueued, processed);
+}
+
+// Latência de drenagem (última tarefa concluída -> pool encerrado): polling antigo vs latch.
+void bench_drain(int nthreads){
+    quiet = 1;
+    const int rounds = 20;
+    printf("%-10s %12s %12s\n", "drenagem", "media ms", "max ms");
+    for (int mode=0;mode<2;mode++){
+        drain_polling = (mode == 0);
+        double sum = 0, mx = 0;
+        for (int r=0;r<rounds;r++){
+            pool_start(nthreads);
+            for (int i=0;i<4*nthreads;i++){
+                Task* t = new_task(2000000 + 100000*((r*7 + i) % 13), 0);
+                t->t_submit = now_ms(); t->deadline = 0;
+                enqueue(t);
+                InterlockedIncrement(&enqueued);
+            }
+            pool_stop();
+            sum += drain_lat_ms;
+            if (drain_lat_ms > mx) mx = drain_lat_ms;
+            double p50, p99, m;
+            latency_summary(&p50, &p99, &m);
+        }
+        printf("%-10s %12.2f %12.2f\n", mode == 0 ? "polling" : "latch", sum / rounds, mx);
+    }
+    drain_polling = 0;
+}
+
+int main(int argc, char** argv){
+    InitializeCriticalSection(&qcs);
+    InitializeConditionVariable(&qcv);
+    for (int c=0;c<MAX_CLASSES;c++) InitializeSRWLock(&queues[c].lock);
+    InitializeCriticalSection(&scs);
+    InitializeCriticalSection(&fcs);
+    InitializeConditionVariable(&idle_cv);
+
+    int nthreads = 4, bench = 0, batch = 0;
+    for (int i=1;i<argc;i++){
+        if (strcmp(argv[i], "--politica") == 0 && i+1 < argc) {
+            const char* p = argv[++i];
+            int k;
+            for (k=0;k<4 && strcmp(p, policy_names[k]);k++);
+            if (k == 4) { printf("Politica desconhecida '%s' (use fifo, sjf, edf ou wfq)\n", p); return 1; }
+            policy = (Policy)k;
+        } else if (strcmp(argv[i], "--pesos") == 0 && i+1 < argc) {
+            char* p = argv[++i];
+            for (int c=0;c<MAX_CLASSES && *p;c++){
+                weights[c] = strtod(p, &p);
+                if (weights[c] <= 0) { printf("Peso invalido para a classe %d\n", c); return 1; }
+                if (*p == ',') p++;
+            }
+        } else if (strcmp(argv[i], "--elastico") == 0 && i+1 < argc) {
+            if (sscanf(argv[++i], "%d:%d", &min_workers, &max_workers) != 2 || min_workers < 1
+                || max_workers < min_workers || max_workers > MAX_WORKERS) {
+                printf("Limites invalidos '%s' (use MIN:MAX com 1 <= MIN <= MAX <= %d)\n", argv[i], MAX_WORKERS); return 1;
+            }
+            elastic = 1;
+        }
+        else if (strcmp(argv[i], "--ocioso") == 0 && i+1 < argc) idle_ms = (DWORD)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--lat-alvo") == 0 && i+1 < argc) lat_target_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--profundidade") == 0 && i+1 < argc) depth_per_worker = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--resfriamento") == 0 && i+1 < argc) cooldown_ms = atof(argv[++i]);
+        else if (strcmp(argv[i], "--bench-elastico") == 0) bench = 1;
+        else if (strcmp(argv[i], "--lote") == 0 && i+1 < argc) batch = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--quieto") == 0) quiet = 1;
+        else if (strcmp(argv[i], "--demo-futuros") == 0) bench = 2;
+        else if (strcmp(argv[i], "--bench-drenagem") == 0) bench = 3;
+        else nthreads = atoi(argv[i]);
+    }
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > MAX_WORKERS) nthreads = MAX_WORKERS;
+    if (depth_per_worker < 1) depth_per_worker = 1;
+
+    if (bench == 1) {
+        bench_elastic();
+    } else if (bench == 2) {
+        demo_futures(nthreads);
+    } else if (bench == 3) {
+        bench_drain(nthreads);
+    } else {
+        pool_start(elastic ? min_workers : nthreads);
+        // read stdin
+        long long lines = 0;
+        double t0 = now_ms();
+        if (batch > 0) lines = bulk_ingest(batch);
+        else {
+            char line[128];
+            while (fgets(line,sizeof(line),stdin)) { submit_line(line); lines++; }
+        }
+        double ingest = now_ms() - t0;
+        double total = pool_stop();
+
+        printf("Enqueued=%ld Processed=%ld\n", enqueued, processed);
+        printf("Ingestao: %lld linhas em %.1f ms (%.0f linhas/s, %s)\n", lines, ingest,
+               ingest > 0 ? lines * 1000.0 / ingest : 0.0, batch > 0 ? "blocos + lotes" : "fgets + sscanf");
+        printf("Processamento: %ld tarefas em %.1f ms (%.0f tarefas/s)\n", processed, total,
+               total > 0 ? processed * 1000.0 / total : 0.0);
+        printf("Drenagem: %.2f ms entre a ultima tarefa e o fim do pool\n", drain_lat_ms);
+        print_class_stats();
+        if (elastic) print_scale_log(total);
+    }
+    for (int c=0;c<MAX_CLASSES;c++) free(queues[c].h.a);
+    free(scale_log);
+    DeleteCriticalSection(&fcs);
+    DeleteCriticalSection(&scs);
     DeleteCriticalSection(&qcs);
-    free(ths);
+    TRACE_DUMP("ex5_trace.json");
     return 0;
 }
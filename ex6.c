@@ -1,92 +1,997 @@
 // ex6_mapreduce.c
 // Lê um arquivo grande de inteiros (um por linha) e calcula soma total + histograma
 // usando P threads. Arquivo particionado em blocos (offsets) e cada thread faz "map" local.
-// A redução é feita pela thread principal com exclusão mínima.
+// A redução é feita pelos próprios workers, em árvore (ver reduce_tree).
+//
+// Modo streaming (--stream, ou arquivo "-" para stdin): a thread principal faz leituras
+// sequenciais grandes em chunks alinhados por linha e os entrega aos P mappers por uma fila;
+// a memória fica limitada a (2P+1) x CHUNK_BYTES, independente do tamanho da entrada,
+// e o resultado é idêntico ao do modo normal.
+//
+// Formato binário colunar (--converter): blocos de int64 fixos ou delta/varint com rodapés
+// min/max/soma por bloco; o leitor mapeia o arquivo (MapViewOfFile) e lê os blocos sem cópia,
+// e --soma responde a soma total apenas a partir dos rodapés.
+//
+// Histograma configurável: --bins N e --faixa MIN:MAX (bins de largura fixa, com contagem
+// abaixo/acima da faixa); sem --faixa mantém o bin |v| % N original. Também imprime
+// min/max/média/variância e quantis de um sketch log-linear mesclável. Os resultados
+// parciais são combinados pelos próprios workers em uma redução em árvore.
+//
+// --pin fixa cada worker em uma CPU (intercalando nós NUMA) e aloca seus acumuladores,
+// alinhados a 64 bytes, no nó da própria worker. --sweep mede P = 1, 2, 4, ... até P
+// e imprime tempo, speedup e eficiência paralela.
 //
 // Compilar: cl ex6_mapreduce.c  OR  gcc -o ex6_mapreduce.exe ex6_mapreduce.c
-// Uso: ex6_mapreduce.exe arquivo.txt P
-// Observação: implementado de forma simples sem mmap (fácil e portátil no Windows).
+// Uso: ex6_mapreduce.exe arquivo.txt P [--stream] [--bins N] [--faixa MIN:MAX] [--pin] [--sweep]
+//      ex6_mapreduce.exe - P            (lê de stdin, sempre em streaming)
+//      ex6_mapreduce.exe --converter arquivo.txt arquivo.bin
+//      ex6_mapreduce.exe arquivo.bin P [--soma]   (formato detectado pelo cabeçalho)
+//      ex6_mapreduce.exe arquivo P --processos    (P processos worker + segmento compartilhado)
+// Observação: os modos texto são implementados sem mmap (fácil e portátil no Windows).
 
+#ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
+#endif
+#ifndef PSAPI_VERSION
+  #define PSAPI_VERSION 2       /* GetProcessMemoryInfo -> K32GetProcessMemoryInfo (kernel32) */
+#endif
 #include <windows.h>
+#include <psapi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+
+#include <malloc.h>
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+#include "cache.h"
+
+#define CHUNK_BYTES (4*1024*1024)
+
+// Sketch de quantis log-linear (estilo HDR): 2^SK_SUB_BITS sub-baldes por potência de 2,
+// erro relativo < 2^-SK_SUB_BITS; mesclável somando contagens.
+#define SK_SUB_BITS 7
+#define SK_SUB (1<<SK_SUB_BITS)
+#define SK_BUCKETS ((64 - SK_SUB_BITS + 1) * SK_SUB)
 
 typedef struct {
-    char *filename;
+    long long n;
+    long long min, max;
+    double mean, m2;            // Welford; mesclados pela fórmula de Chan
+    long long *sk[2];           // [0] = negativos (por |v|), [1] = não negativos
+} Stats;
+
+// Alinhado a 64 bytes: acumuladores de workers vizinhos não dividem linha de cache.
+typedef struct {
+    CACHE_ALIGN char *filename;
     long start_line;
-    long end_line; // inclusive
+    long end_line; // inclusive (no formato colunar: índices de bloco)
     long long partial_sum;
-    int *hist; int hist_bins;
+    long long *hist; int hist_bins;
+    long long under, over;      // fora de [hist_min, hist_max) no modo por faixa
+    Stats st;
     int id;
+    int node;      // nó NUMA onde os acumuladores foram alocados
+    long lines;    // linhas processadas (modos streaming e colunar)
 } WorkerArg;
 
+enum { HIST_MOD, HIST_RANGE };
+
 int P = 4;
 int HIST_BINS = 10;
+int hist_mode = HIST_MOD;       // HIST_MOD: bin = |v| % bins (comportamento original)
+long long hist_min, hist_max;   // HIST_RANGE: bins de largura (max-min)/bins
 WorkerArg *args;
+HANDLE *reduce_done;            // sinalizado quando o worker i entregou seu resultado parcial
+
+int use_procs = 0;              // --processos: P processos worker em vez de threads
+int pin_threads = 0;            // --pin: fixa cada worker em uma CPU, intercalando nós NUMA
+int n_topo = 0;
+int topo_cpu[64], topo_node[64];
+
+static double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
+
+// Ordem de CPUs para os workers: a k-ésima CPU de cada nó, nó a nó (espalha por soquete).
+// Limitado ao grupo de processadores 0 (até 64 CPUs lógicas).
+static void topology_init(){
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest) || highest > 63) highest = 0;
+    ULONGLONG masks[64] = {0};
+    for (ULONG n=0;n<=highest;n++)
+        if (!GetNumaNodeProcessorMask((UCHAR)n, &masks[n])) masks[n] = 0;
+    if (masks[0] == 0 && highest == 0) {
+        SYSTEM_INFO si; GetSystemInfo(&si);
+        masks[0] = si.dwNumberOfProcessors >= 64 ? ~0ULL : ((1ULL << si.dwNumberOfProcessors) - 1);
+    }
+    for (int round=0; round<64 && n_topo<64; round++){
+        int any = 0;
+        for (ULONG n=0;n<=highest && n_topo<64;n++){
+            int seen = 0;
+            for (int c=0;c<64;c++){
+                if (!(masks[n] & (1ULL << c))) continue;
+                if (seen++ == round) { topo_cpu[n_topo] = c; topo_node[n_topo] = (int)n; n_topo++; any = 1; break; }
+            }
+        }
+        if (!any) break;
+    }
+}
+
+static void* node_alloc(size_t bytes, int node){
+    if (pin_threads)
+        return VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE, (DWORD)node);
+    return VirtualAlloc(NULL, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+}
+
+// Executado no início de cada worker: fixa a afinidade e aloca os acumuladores
+// a partir da própria thread, para que as páginas (zeradas) fiquem no seu nó.
+static void worker_setup(WorkerArg* a){
+    a->node = 0;
+    if (pin_threads && n_topo > 0) {
+        int k = a->id % n_topo;
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << topo_cpu[k]);
+        a->node = topo_node[k];
+    }
+    a->hist = (long long*)node_alloc(sizeof(long long)*a->hist_bins, a->node);
+    a->st.sk[0] = (long long*)node_alloc(sizeof(long long)*SK_BUCKETS, a->node);
+    a->st.sk[1] = (long long*)node_alloc(sizeof(long long)*SK_BUCKETS, a->node);
+}
+
+static int sk_index(uint64_t m){
+    if (m < SK_SUB) return (int)m;
+#ifdef _MSC_VER
+    unsigned long e; _BitScanReverse64(&e, m);
+#else
+    int e = 63 - __builtin_clzll(m);
+#endif
+    return ((int)e - SK_SUB_BITS + 1) * SK_SUB + (int)((m >> (e - SK_SUB_BITS)) & (SK_SUB-1));
+}
+
+// Limite inferior e largura do balde idx (inverso de sk_index).
+static uint64_t sk_low(int idx, uint64_t* width){
+    if (idx < SK_SUB) { *width = 1; return (uint64_t)idx; }
+    int g = idx / SK_SUB, sub = idx % SK_SUB;
+    *width = (uint64_t)1 << (g - 1);
+    return (uint64_t)(SK_SUB + sub) << (g - 1);
+}
+
+static void stats_add(Stats* s, long v){
+    if (s->n == 0 || v < s->min) s->min = v;
+    if (s->n == 0 || v > s->max) s->max = v;
+    s->n++;
+    double d = v - s->mean;
+    s->mean += d / s->n;
+    s->m2 += d * (v - s->mean);
+    if (v < 0) s->sk[0][sk_index((uint64_t)0 - (uint64_t)(long long)v)]++;
+    else s->sk[1][sk_index((uint64_t)v)]++;
+}
+
+static void stats_merge(Stats* a, const Stats* b){
+    if (b->n == 0) return;
+    if (a->n == 0 || b->min < a->min) a->min = b->min;
+    if (a->n == 0 || b->max > a->max) a->max = b->max;
+    long long n = a->n + b->n;
+    double d = b->mean - a->mean;
+    a->mean += d * b->n / n;
+    a->m2 += b->m2 + d * d * ((double)a->n * b->n / n);
+    a->n = n;
+    for (int i=0;i<SK_BUCKETS;i++) { a->sk[0][i] += b->sk[0][i]; a->sk[1][i] += b->sk[1][i]; }
+}
+
+// Valor aproximado do quantil q (0..1): percorre negativos do maior |v| ao menor, depois positivos.
+static double stats_quantile(const Stats* s, double q){
+    long long rank = (long long)(q * (s->n - 1)), seen = 0;
+    uint64_t w;
+    for (int i=SK_BUCKETS-1;i>=0;i--){
+        seen += s->sk[0][i];
+        if (seen > rank) { uint64_t lo = sk_low(i, &w); return -((double)lo + (w - 1) / 2.0); }
+    }
+    for (int i=0;i<SK_BUCKETS;i++){
+        seen += s->sk[1][i];
+        if (seen > rank) { uint64_t lo = sk_low(i, &w); return (double)lo + (w - 1) / 2.0; }
+    }
+    return (double)s->max;
+}
+
+static void map_value(WorkerArg* a, long v){
+    a->partial_sum += v;
+    if (hist_mode == HIST_RANGE) {
+        if (v < hist_min) a->under++;
+        else if (v >= hist_max) a->over++;
+        else {
+            // diferenças em unsigned/double: max - min estoura long long em faixas largas, e acima de
+            // 2^53 o arredondamento pode dar índice == bins para v logo abaixo de hist_max
+            double off = (double)((unsigned long long)v - (unsigned long long)hist_min);
+            int bin = (int)(off * a->hist_bins / ((double)hist_max - (double)hist_min));
+            a->hist[bin < a->hist_bins ? bin : a->hist_bins - 1]++;
+        }
+    } else {
+        int bin = (v >= 0 ? v % a->hist_bins : (-v) % a->hist_bins);
+        a->hist[bin]++;
+    }
+    stats_add(&a->st, v);
+}
+
+static void merge_into(WorkerArg* a, const WorkerArg* b){
+    a->partial_sum += b->partial_sum;
+    for (int i=0;i<a->hist_bins;i++) a->hist[i] += b->hist[i];
+    a->under += b->under; a->over += b->over;
+    stats_merge(&a->st, &b->st);
+}
+
+static SIZE_T peak_rss(){
+    PROCESS_MEMORY_COUNTERS pmc;
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return pmc.PeakWorkingSetSize;
+}
+
+// PeakWorkingSetSize só cresce durante a vida do processo: no --sweep cada P precisa da sua
+// própria medida. Cada worker amostra o working set atual ao terminar a varredura (mapeamento
+// e acumuladores ainda vivos) e job_rss fica com o maior valor do job.
+volatile LONG64 job_rss = 0;
+
+static SIZE_T cur_rss(){
+    PROCESS_MEMORY_COUNTERS pmc;
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return pmc.WorkingSetSize;
+}
+
+static void note_rss(){
+    LONG64 ws = (LONG64)cur_rss(), old;
+    while ((old = job_rss) < ws && InterlockedCompareExchange64(&job_rss, ws, old) != old);
+}
+
+// Redução em árvore executada pelos próprios workers: na rodada `step`, o worker i
+// (múltiplo de 2*step) absorve o resultado de i+step. O total fica em args[0]
+// após log2(P) rodadas, sem um laço serial sobre todos os workers na main.
+static void reduce_tree(WorkerArg* a){
+    if (!reduce_done) return;   // worker em processo separado: o coordenador combina
+    note_rss();
+    int i = a->id;
+    for (int step=1; step<P; step*=2){
+        if (i % (2*step)) break;
+        if (i + step < P) {
+            WaitForSingleObject(reduce_done[i+step], INFINITE);
+            merge_into(a, &args[i+step]);
+        }
+    }
+    SetEvent(reduce_done[i]);
+}
 
 DWORD WINAPI worker(LPVOID param){
     WorkerArg* a = (WorkerArg*)param;
+    worker_setup(a);
     FILE *f = fopen(a->filename,"r");
-    if (!f) return 0;
+    if (!f) { reduce_tree(a); return 0; }
     char buf[256];
     long line = 0;
     while (fgets(buf,sizeof(buf),f)){
         if (line > a->end_line) break;
         if (line >= a->start_line){
-            long v = atol(buf);
-            a->partial_sum += v;
-            int bin = (v >= 0 ? v % a->hist_bins : (-v) % a->hist_bins);
-            a->hist[bin]++;
+            map_value(a, atol(buf));
         }
         line++;
     }
     fclose(f);
+    reduce_tree(a);
     return 0;
 }
 
-int main(int argc, char** argv){
-    if (argc < 3){
-        printf("Usage: %s arquivo.txt P\n", argv[0]); return 1;
+/* ---------------------------- modo streaming ---------------------------- */
+
+typedef struct { char *data; int len; } Chunk;
+
+typedef struct {
+    Chunk **buf; int cap; int head, tail, cnt;
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE not_empty, not_full;
+} Ring;
+
+void ring_init(Ring* r, int cap){
+    r->buf = malloc(sizeof(Chunk*)*cap);
+    r->cap = cap; r->head=r->tail=r->cnt=0;
+    InitializeCriticalSection(&r->cs);
+    InitializeConditionVariable(&r->not_empty);
+    InitializeConditionVariable(&r->not_full);
+}
+void ring_destroy(Ring* r){
+    free(r->buf);
+    DeleteCriticalSection(&r->cs);
+}
+void ring_put(Ring* r, Chunk* v){
+    EnterCriticalSection(&r->cs);
+    while(r->cnt==r->cap) SleepConditionVariableCS(&r->not_full,&r->cs,INFINITE);
+    r->buf[r->tail]=v; r->tail=(r->tail+1)%r->cap; r->cnt++;
+    WakeConditionVariable(&r->not_empty);
+    LeaveCriticalSection(&r->cs);
+}
+Chunk* ring_get(Ring* r){
+    EnterCriticalSection(&r->cs);
+    while(r->cnt==0) SleepConditionVariableCS(&r->not_empty,&r->cs,INFINITE);
+    Chunk* v = r->buf[r->head]; r->head=(r->head+1)%r->cap; r->cnt--;
+    WakeConditionVariable(&r->not_full);
+    LeaveCriticalSection(&r->cs);
+    return v;
+}
+
+Ring full_q, free_q;
+
+// Mesma semântica de atol() restrita a [p, end): espaços iniciais, sinal, dígitos.
+static long parse_long(const char* p, const char* end){
+    while (p < end && (*p==' ' || *p=='\t' || *p=='\r' || *p=='\v' || *p=='\f')) p++;
+    int neg = 0;
+    if (p < end && (*p=='-' || *p=='+')) { neg = (*p=='-'); p++; }
+    long v = 0;
+    while (p < end && *p >= '0' && *p <= '9') { v = v*10 + (*p - '0'); p++; }
+    return neg ? -v : v;
+}
+
+DWORD WINAPI stream_worker(LPVOID param){
+    WorkerArg* a = (WorkerArg*)param;
+    worker_setup(a);
+    for (;;) {
+        Chunk* c = ring_get(&full_q);
+        if (!c) break;  // poison pill
+        const char *p = c->data, *end = c->data + c->len;
+        while (p < end) {
+            const char* nl = memchr(p, '\n', end - p);
+            const char* eol = nl ? nl : end;
+            map_value(a, parse_long(p, eol));
+            a->lines++;
+            p = nl ? nl + 1 : end;
+        }
+        ring_put(&free_q, c);
     }
-    char *filename = argv[1];
-    P = atoi(argv[2]); if (P<=0) P=1;
+    reduce_tree(a);
+    return 0;
+}
+
+// Preenche buf com até `want` bytes; leituras de pipe podem voltar parciais.
+static int read_full(HANDLE h, char* buf, int want, int* eof){
+    int got = 0;
+    while (got < want) {
+        DWORD n = 0;
+        if (!ReadFile(h, buf + got, (DWORD)(want - got), &n, NULL) || n == 0) { *eof = 1; break; }
+        got += (int)n;
+    }
+    return got;
+}
+
+// Lê a entrada sequencialmente e despacha chunks terminados em '\n' aos mappers.
+// O resto parcial do último registro é levado para o início do chunk seguinte.
+static void stream_produce(HANDLE h){
+    char* carry = malloc(CHUNK_BYTES);
+    int carry_len = 0, eof = 0, warned = 0;
+    while (!eof) {
+        Chunk* c = ring_get(&free_q);
+        memcpy(c->data, carry, carry_len);
+        int len = carry_len + read_full(h, c->data + carry_len, CHUNK_BYTES - carry_len, &eof);
+        carry_len = 0;
+        if (!eof) {
+            char* last = c->data + len;
+            while (last > c->data && last[-1] != '\n') last--;
+            if (last > c->data) {
+                carry_len = (int)(c->data + len - last);
+                memcpy(carry, last, carry_len);
+                len -= carry_len;
+            } else if (!warned) {
+                printf("Aviso: linha maior que %d bytes foi dividida\n", CHUNK_BYTES);
+                warned = 1;
+            }
+        }
+        c->len = len;
+        if (len > 0) ring_put(&full_q, c);
+        else ring_put(&free_q, c);
+    }
+    free(carry);
+}
+
+static long run_stream(const char* filename){
+    HANDLE h;
+    if (strcmp(filename, "-") == 0) h = GetStdHandle(STD_INPUT_HANDLE);
+    else {
+        // SEQUENTIAL_SCAN: readahead agressivo do cache do sistema
+        h = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (h == INVALID_HANDLE_VALUE) { printf("Nao foi possivel abrir %s\n", filename); return -1; }
+    }
+
+    // P chunks em processamento + P na fila: o leitor fica sempre à frente dos mappers
+    int n_chunks = 2*P;
+    Chunk* chunks = malloc(sizeof(Chunk)*n_chunks);
+    ring_init(&free_q, n_chunks);
+    ring_init(&full_q, n_chunks + P);   // + P poison pills
+    for (int i=0;i<n_chunks;i++){
+        chunks[i].data = malloc(CHUNK_BYTES);
+        ring_put(&free_q, &chunks[i]);
+    }
+
+    HANDLE *ths = malloc(sizeof(HANDLE)*P);
+    for (int i=0;i<P;i++) ths[i] = CreateThread(NULL,0,stream_worker,&args[i],0,NULL);
+    stream_produce(h);
+    for (int i=0;i<P;i++) ring_put(&full_q, NULL);
+    WaitForMultipleObjects(P, ths, TRUE, INFINITE);
 
-    // conta linhas
-    FILE *f = fopen(filename,"r");
-    if (!f){ perror("fopen"); return 1; }
-    char buf[256];
     long total_lines = 0;
-    while (fgets(buf,sizeof(buf),f)) total_lines++;
+    for (int i=0;i<P;i++) { total_lines += args[i].lines; CloseHandle(ths[i]); }
+    if (strcmp(filename, "-") != 0) CloseHandle(h);
+    for (int i=0;i<n_chunks;i++) free(chunks[i].data);
+    ring_destroy(&free_q); ring_destroy(&full_q);
+    free(chunks); free(ths);
+    return total_lines;
+}
+
+/* ------------------------ formato binário colunar ------------------------
+ *
+ * [ColHeader][bloco 0][bloco 1]...[BlockFooter x n_blocks]
+ * Cada bloco guarda até COL_BLOCK_VALUES inteiros, como int64 fixos (lidos direto
+ * do mapeamento, sem cópia) ou como deltas zigzag em varint, o que for menor.
+ * Os rodapés guardam min/max/soma de cada bloco: a soma total sai só deles.
+ * ------------------------------------------------------------------------- */
+#define COL_MAGIC "EX6COL1"
+#define COL_BLOCK_VALUES 65536
+enum { ENC_FIXED64 = 0, ENC_DELTA_VARINT = 1 };
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_values;
+    uint64_t n_values;
+    uint64_t n_blocks;
+    uint64_t footer_offset;
+} ColHeader;
+
+typedef struct {
+    uint64_t offset;        // início do bloco (alinhado a 8 bytes)
+    uint64_t bytes;
+    uint32_t count;
+    uint32_t encoding;
+    int64_t min, max, sum;
+} BlockFooter;
+
+static const char* col_base;            // mapeamento do arquivo inteiro
+static const BlockFooter* col_blocks;
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t unzigzag(uint64_t u) { return (int64_t)(u >> 1) ^ -(int64_t)(u & 1); }
+
+static size_t put_varint(unsigned char* out, uint64_t u){
+    size_t n = 0;
+    while (u >= 0x80) { out[n++] = (unsigned char)(u | 0x80); u >>= 7; }
+    out[n++] = (unsigned char)u;
+    return n;
+}
+
+static void write_block(FILE* out, const int64_t* vals, uint32_t count, unsigned char* scratch,
+                        uint64_t* offset, BlockFooter* ft){
+    static const char pad[8] = {0};
+    size_t gap = (size_t)((8 - (*offset % 8)) % 8);
+    fwrite(pad, 1, gap, out);
+    *offset += gap;
+
+    ft->offset = *offset; ft->count = count;
+    ft->min = ft->max = vals[0]; ft->sum = 0;
+    size_t vbytes = 0; int64_t prev = 0;
+    for (uint32_t i=0;i<count;i++){
+        if (vals[i] < ft->min) ft->min = vals[i];
+        if (vals[i] > ft->max) ft->max = vals[i];
+        ft->sum += vals[i];
+        vbytes += put_varint(scratch + vbytes, zigzag(vals[i] - prev));
+        prev = vals[i];
+    }
+    if (vbytes < (size_t)count * 8) {
+        ft->encoding = ENC_DELTA_VARINT; ft->bytes = vbytes;
+        fwrite(scratch, 1, vbytes, out);
+    } else {
+        ft->encoding = ENC_FIXED64; ft->bytes = (uint64_t)count * 8;
+        fwrite(vals, 8, count, out);
+    }
+    *offset += ft->bytes;
+}
+
+// Converte o texto (um inteiro por linha, mesma leitura do modo normal) para o formato colunar.
+static int convert_to_columnar(const char* in_path, const char* out_path){
+    FILE *in = fopen(in_path, "r");
+    if (!in) { perror("fopen"); return 1; }
+    FILE *out = fopen(out_path, "wb");
+    if (!out) { perror("fopen"); fclose(in); return 1; }
+
+    ColHeader hdr; memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, COL_MAGIC, sizeof(COL_MAGIC));
+    hdr.version = 1; hdr.block_values = COL_BLOCK_VALUES;
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    uint64_t offset = sizeof(hdr);
+
+    int64_t *vals = malloc(sizeof(int64_t)*COL_BLOCK_VALUES);
+    unsigned char *scratch = malloc((size_t)COL_BLOCK_VALUES * 10);   // pior caso do varint
+    size_t cap_blocks = 1024;
+    BlockFooter *footers = malloc(sizeof(BlockFooter)*cap_blocks);
+    uint32_t n = 0;
+    char buf[256];
+    while (fgets(buf,sizeof(buf),in)){
+        vals[n++] = atol(buf);
+        hdr.n_values++;
+        if (n == COL_BLOCK_VALUES) {
+            if (hdr.n_blocks == cap_blocks) footers = realloc(footers, sizeof(BlockFooter)*(cap_blocks *= 2));
+            write_block(out, vals, n, scratch, &offset, &footers[hdr.n_blocks++]);
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        if (hdr.n_blocks == cap_blocks) footers = realloc(footers, sizeof(BlockFooter)*(cap_blocks *= 2));
+        write_block(out, vals, n, scratch, &offset, &footers[hdr.n_blocks++]);
+    }
+    static const char pad[8] = {0};
+    size_t gap = (size_t)((8 - (offset % 8)) % 8);
+    fwrite(pad, 1, gap, out);
+    hdr.footer_offset = offset + gap;
+    fwrite(footers, sizeof(BlockFooter), (size_t)hdr.n_blocks, out);
+    fseek(out, 0, SEEK_SET);
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    printf("Convertido: %llu valores em %llu blocos (%llu bytes de dados)\n",
+           (unsigned long long)hdr.n_values, (unsigned long long)hdr.n_blocks,
+           (unsigned long long)(hdr.footer_offset - sizeof(hdr)));
+    fclose(in); fclose(out);
+    free(vals); free(scratch); free(footers);
+    return 0;
+}
+
+DWORD WINAPI columnar_worker(LPVOID param){
+    WorkerArg* a = (WorkerArg*)param;
+    worker_setup(a);
+    for (long b=a->start_line;b<=a->end_line;b++){
+        const BlockFooter* ft = &col_blocks[b];
+        const char* data = col_base + ft->offset;
+        if (ft->encoding == ENC_FIXED64) {
+            const int64_t* v = (const int64_t*)data;    // direto do mapeamento
+            for (uint32_t i=0;i<ft->count;i++) map_value(a, (long)v[i]);
+        } else {
+            // varints corrompidos não passam do fim do bloco (col_valid garantiu que ele cabe no arquivo)
+            const unsigned char* p = (const unsigned char*)data;
+            const unsigned char* end = p + ft->bytes;
+            int64_t prev = 0;
+            uint32_t i;
+            for (i=0;i<ft->count && p<end;i++){
+                uint64_t u = 0; int shift = 0;
+                while ((*p & 0x80) && p+1 < end && shift < 63) { u |= (uint64_t)(*p++ & 0x7F) << shift; shift += 7; }
+                u |= (uint64_t)(*p++ & 0x7F) << shift;
+                prev += unzigzag(u);
+                map_value(a, (long)prev);
+            }
+            a->lines += i;
+            continue;
+        }
+        a->lines += ft->count;
+    }
+    reduce_tree(a);
+    return 0;
+}
+
+static int is_columnar(const char* filename){
+    char magic[8] = {0};
+    FILE* f = fopen(filename, "rb");
+    if (!f) return 0;
+    size_t n = fread(magic, 1, sizeof(magic), f);
     fclose(f);
+    return n == sizeof(magic) && memcmp(magic, COL_MAGIC, sizeof(COL_MAGIC)) == 0;
+}
+
+static void col_unmap(HANDLE h, HANDLE map){
+    UnmapViewOfFile(col_base);
+    CloseHandle(map); CloseHandle(h);
+}
+
+// O cabeçalho e os rodapés vêm do arquivo: um .col truncado ou corrompido não pode
+// levar os workers para fora do mapeamento. Só lê rodapés (as páginas de dados ficam intactas).
+static int col_valid(const char* filename, const ColHeader* hdr, HANDLE h){
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(h, &sz)) { printf("GetFileSizeEx falhou (%lu)\n", GetLastError()); return 0; }
+    uint64_t size = (uint64_t)sz.QuadPart;
+    if (size < sizeof(ColHeader) || memcmp(hdr->magic, COL_MAGIC, sizeof(COL_MAGIC)) != 0) {
+        printf("%s: cabecalho colunar invalido\n", filename); return 0;
+    }
+    if (hdr->footer_offset < sizeof(ColHeader) || hdr->footer_offset > size ||
+        hdr->n_blocks > (size - hdr->footer_offset) / sizeof(BlockFooter) ||
+        hdr->n_blocks > (uint64_t)LONG_MAX) {
+        printf("%s: rodapes fora do arquivo (%llu blocos em %llu, arquivo de %llu bytes)\n", filename,
+               (unsigned long long)hdr->n_blocks, (unsigned long long)hdr->footer_offset,
+               (unsigned long long)size);
+        return 0;
+    }
+    for (uint64_t b=0;b<hdr->n_blocks;b++){
+        const BlockFooter* ft = &col_blocks[b];
+        int ok = ft->offset >= sizeof(ColHeader) && ft->offset % 8 == 0 &&
+                 ft->offset <= hdr->footer_offset && ft->bytes <= hdr->footer_offset - ft->offset;
+        if (ok && ft->encoding == ENC_FIXED64) ok = ft->bytes >= (uint64_t)ft->count * 8;
+        else if (ok) ok = ft->encoding == ENC_DELTA_VARINT && ft->bytes >= ft->count;
+        if (!ok) {
+            printf("%s: bloco %llu invalido (offset %llu, %llu bytes, arquivo de %llu bytes)\n", filename,
+                   (unsigned long long)b, (unsigned long long)ft->offset, (unsigned long long)ft->bytes,
+                   (unsigned long long)size);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Mapeia o arquivo e distribui blocos inteiros aos P workers.
+// Com sum_only, responde só com os rodapés, sem tocar nas páginas de dados.
+static const ColHeader* col_map(const char* filename, HANDLE* h, HANDLE* map){
+    *h = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (*h == INVALID_HANDLE_VALUE) { printf("Nao foi possivel abrir %s\n", filename); return NULL; }
+    *map = CreateFileMapping(*h, NULL, PAGE_READONLY, 0, 0, NULL);
+    col_base = *map ? (const char*)MapViewOfFile(*map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!col_base) { printf("MapViewOfFile falhou (%lu)\n", GetLastError()); CloseHandle(*h); return NULL; }
+    const ColHeader* hdr = (const ColHeader*)col_base;
+    col_blocks = (const BlockFooter*)(col_base + hdr->footer_offset);
+    if (!col_valid(filename, hdr, *h)) { col_unmap(*h, *map); return NULL; }
+    return hdr;
+}
+
+static long run_columnar(const char* filename, int sum_only){
+    HANDLE h, map;
+    const ColHeader* hdr = col_map(filename, &h, &map);
+    if (!hdr) return -1;
+    long n_blocks = (long)hdr->n_blocks;
+
+    if (sum_only) {
+        long long sum = 0; int64_t mn = 0, mx = 0;
+        for (long b=0;b<n_blocks;b++){
+            sum += col_blocks[b].sum;
+            if (b == 0 || col_blocks[b].min < mn) mn = col_blocks[b].min;
+            if (b == 0 || col_blocks[b].max > mx) mx = col_blocks[b].max;
+        }
+        printf("Linhas=%llu Sum=%lld Min=%lld Max=%lld (somente rodapés, %ld blocos)\n",
+               (unsigned long long)hdr->n_values, sum, (long long)mn, (long long)mx, n_blocks);
+    } else {
+        HANDLE *ths = malloc(sizeof(HANDLE)*P);
+        long per = n_blocks / P;
+        for (int i=0;i<P;i++){
+            args[i].start_line = i*per;
+            args[i].end_line = (i==P-1) ? (n_blocks-1) : ((i+1)*per -1);
+            ths[i] = CreateThread(NULL,0,columnar_worker,&args[i],0,NULL);
+        }
+        WaitForMultipleObjects(P, ths, TRUE, INFINITE);
+        for (int i=0;i<P;i++) CloseHandle(ths[i]);
+        free(ths);
+    }
+    long total_lines = (long)hdr->n_values;
+    col_unmap(h, map);
+    return total_lines;
+}
+
+/* ------------------- modo multiprocesso com memória compartilhada -------------------
+ *
+ * O coordenador cria um segmento nomeado (file mapping sem arquivo) com um cabeçalho
+ * de configuração e um slot de resultados por worker, e dispara P processos
+ * "ex6 --proc-worker <pid> <i>". Cada processo mapeia sua faixa, publica somas,
+ * histograma e sketch no seu slot e decrementa o latch; o último sinaliza o evento
+ * nomeado. (WaitOnAddress não atravessa processos, daí contador + evento nomeado.)
+ * ------------------------------------------------------------------------------- */
+typedef struct {
+    volatile LONG remaining;        // latch: processos que ainda não publicaram
+    int P, columnar, pin;
+    int hist_bins, hist_mode;
+    long long hist_min, hist_max;
+    long total_lines;               // texto: linhas contadas pelo coordenador
+    char filename[MAX_PATH];
+} ShmHeader;
+
+typedef struct {
+    long long partial_sum, under, over;
+    long lines;
+    Stats st;                       // st.sk não vale entre processos; contagens vêm após o slot
+    SIZE_T peak_rss;
+} ShmSlot;
+
+#define SHM_ALIGN(x) (((x) + 63) & ~(size_t)63)
+SIZE_T child_rss_total = 0;         // soma dos picos de RSS dos processos worker
+
+static size_t shm_slot_bytes(int bins){
+    return SHM_ALIGN(sizeof(ShmSlot)) + SHM_ALIGN(sizeof(long long)*(bins + 2*SK_BUCKETS));
+}
+static ShmSlot* shm_slot(char* base, int i, int bins){
+    return (ShmSlot*)(base + SHM_ALIGN(sizeof(ShmHeader)) + (size_t)i * shm_slot_bytes(bins));
+}
+static long long* shm_counts(ShmSlot* slot){
+    return (long long*)((char*)slot + SHM_ALIGN(sizeof(ShmSlot)));
+}
 
-    args = malloc(sizeof(WorkerArg)*P);
-    HANDLE *ths = malloc(sizeof(HANDLE)*P);
 
-    long per = total_lines / P;
+static int proc_worker_main(unsigned long ppid, int idx){
+    char name[64];
+    snprintf(name, sizeof(name), "Local\\ex6_shm_%lu", ppid);
+    HANDLE shm = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, name);
+    char* base = shm ? (char*)MapViewOfFile(shm, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (!base) { printf("worker %d: segmento %s indisponivel (%lu)\n", idx, name, GetLastError()); return 2; }
+    ShmHeader* hdr = (ShmHeader*)base;
+    P = hdr->P; HIST_BINS = hdr->hist_bins; hist_mode = hdr->hist_mode;
+    hist_min = hdr->hist_min; hist_max = hdr->hist_max;
+    pin_threads = hdr->pin;
+    if (pin_threads) topology_init();
+
+    WorkerArg* a = (WorkerArg*)_aligned_malloc(sizeof(WorkerArg), 64);
+    memset(a, 0, sizeof(WorkerArg));
+    a->filename = hdr->filename; a->hist_bins = HIST_BINS; a->id = idx;
+    if (hdr->columnar) {
+        HANDLE h, map;
+        const ColHeader* ch = col_map(hdr->filename, &h, &map);
+        if (!ch) return 2;
+        long per = (long)ch->n_blocks / P;
+        a->start_line = idx*per;
+        a->end_line = (idx==P-1) ? ((long)ch->n_blocks-1) : ((idx+1)*per -1);
+        columnar_worker(a);
+        col_unmap(h, map);
+    } else {
+        long per = hdr->total_lines / P;
+        a->start_line = idx*per;
+        a->end_line = (idx==P-1) ? (hdr->total_lines-1) : ((idx+1)*per -1);
+        worker(a);
+    }
+
+    ShmSlot* slot = shm_slot(base, idx, HIST_BINS);
+    long long* counts = shm_counts(slot);
+    slot->partial_sum = a->partial_sum; slot->under = a->under; slot->over = a->over;
+    slot->lines = a->lines;
+    slot->st = a->st;
+    memcpy(counts, a->hist, sizeof(long long)*HIST_BINS);
+    memcpy(counts + HIST_BINS, a->st.sk[0], sizeof(long long)*SK_BUCKETS);
+    memcpy(counts + HIST_BINS + SK_BUCKETS, a->st.sk[1], sizeof(long long)*SK_BUCKETS);
+    slot->peak_rss = peak_rss();
+    // InterlockedDecrement é barreira completa: o slot fica visível antes do latch
+    if (InterlockedDecrement(&hdr->remaining) == 0) {
+        snprintf(name, sizeof(name), "Local\\ex6_done_%lu", ppid);
+        HANDLE done = OpenEvent(EVENT_MODIFY_STATE, FALSE, name);
+        if (done) { SetEvent(done); CloseHandle(done); }
+    }
+    UnmapViewOfFile(base);
+    CloseHandle(shm);
+    return 0;
+}
+
+static long run_processes(const char* filename, int columnar){
+    long total_lines = 0;
+    child_rss_total = 0;
+    if (columnar) {
+        HANDLE h, map;
+        const ColHeader* ch = col_map(filename, &h, &map);
+        if (!ch) return -1;
+        total_lines = (long)ch->n_values;
+        col_unmap(h, map);
+    } else {
+        FILE *f = fopen(filename,"r");
+        if (!f){ perror("fopen"); return -1; }
+        char buf[256];
+        while (fgets(buf,sizeof(buf),f)) total_lines++;
+        fclose(f);
+    }
+
+    unsigned long pid = GetCurrentProcessId();
+    char shm_name[64], done_name[64];
+    snprintf(shm_name, sizeof(shm_name), "Local\\ex6_shm_%lu", pid);
+    snprintf(done_name, sizeof(done_name), "Local\\ex6_done_%lu", pid);
+    unsigned long long bytes = SHM_ALIGN(sizeof(ShmHeader)) + (unsigned long long)P * shm_slot_bytes(HIST_BINS);
+    HANDLE shm = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(bytes >> 32), (DWORD)bytes, shm_name);
+    char* base = shm ? (char*)MapViewOfFile(shm, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (!base) { printf("Nao foi possivel criar o segmento compartilhado (%lu)\n", GetLastError()); return -1; }
+    ShmHeader* hdr = (ShmHeader*)base;     // páginas novas já vêm zeradas
+    hdr->remaining = P;
+    hdr->P = P; hdr->columnar = columnar; hdr->pin = pin_threads;
+    hdr->hist_bins = HIST_BINS; hdr->hist_mode = hist_mode;
+    hdr->hist_min = hist_min; hdr->hist_max = hist_max;
+    hdr->total_lines = total_lines;
+    snprintf(hdr->filename, sizeof(hdr->filename), "%s", filename);
+    HANDLE done = CreateEvent(NULL, TRUE, FALSE, done_name);
+
+    char exe[MAX_PATH];
+    GetModuleFileNameA(NULL, exe, sizeof(exe));
+    PROCESS_INFORMATION *pi = calloc(P, sizeof(PROCESS_INFORMATION));
+    int failed = 0;
+    for (int i=0;i<P;i++){
+        char cmd[MAX_PATH + 64];
+        snprintf(cmd, sizeof(cmd), "\"%s\" --proc-worker %lu %d", exe, pid, i);
+        STARTUPINFOA si;
+        memset(&si, 0, sizeof(si)); si.cb = sizeof(si);
+        if (!CreateProcessA(NULL, cmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi[i])) {
+            printf("CreateProcess falhou para o worker %d (%lu)\n", i, GetLastError());
+            failed = 1;
+            InterlockedDecrement(&hdr->remaining);  // não segura o latch dos demais
+        }
+    }
+
+    // espera o latch; a cada 100 ms verifica se algum worker morreu sem publicar
+    while (hdr->remaining > 0 && WaitForSingleObject(done, 100) == WAIT_TIMEOUT) {
+        for (int i=0;i<P;i++){
+            DWORD code;
+            if (pi[i].hProcess && GetExitCodeProcess(pi[i].hProcess, &code) && code != STILL_ACTIVE && code != 0) failed = 1;
+        }
+        if (failed) break;
+    }
+    child_rss_total = 0;
+    for (int i=0;i<P;i++){
+        if (!pi[i].hProcess) continue;
+        WaitForSingleObject(pi[i].hProcess, INFINITE);
+        CloseHandle(pi[i].hProcess); CloseHandle(pi[i].hThread);
+    }
+
+    if (!failed) {
+        // combinação no coordenador usando as contagens publicadas em cada slot
+        WorkerArg* r = &args[0];
+        r->hist = (long long*)node_alloc(sizeof(long long)*HIST_BINS, 0);
+        r->st.sk[0] = (long long*)node_alloc(sizeof(long long)*SK_BUCKETS, 0);
+        r->st.sk[1] = (long long*)node_alloc(sizeof(long long)*SK_BUCKETS, 0);
+        for (int i=0;i<P;i++){
+            ShmSlot* slot = shm_slot(base, i, HIST_BINS);
+            WorkerArg view;
+            memset(&view, 0, sizeof(view));
+            view.partial_sum = slot->partial_sum; view.under = slot->under; view.over = slot->over;
+            view.hist_bins = HIST_BINS;
+            view.st = slot->st;
+            view.hist = shm_counts(slot);
+            view.st.sk[0] = view.hist + HIST_BINS;
+            view.st.sk[1] = view.hist + HIST_BINS + SK_BUCKETS;
+            merge_into(r, &view);
+            child_rss_total += slot->peak_rss;
+        }
+    } else {
+        printf("Modo multiprocesso falhou\n");
+    }
+    free(pi);
+    CloseHandle(done);
+    UnmapViewOfFile(base);
+    CloseHandle(shm);
+    return failed ? -1 : total_lines;
+}
+
+static void free_job(){
     for (int i=0;i<P;i++){
-        args[i].filename = filename;
-        args[i].start_line = i*per;
-        args[i].end_line = (i==P-1) ? (total_lines-1) : ((i+1)*per -1);
-        args[i].partial_sum = 0;
+        if (args[i].hist) VirtualFree(args[i].hist, 0, MEM_RELEASE);
+        if (args[i].st.sk[0]) VirtualFree(args[i].st.sk[0], 0, MEM_RELEASE);
+        if (args[i].st.sk[1]) VirtualFree(args[i].st.sk[1], 0, MEM_RELEASE);
+        CloseHandle(reduce_done[i]);
+    }
+    _aligned_free(args); free(reduce_done);
+}
+
+// Executa uma redução completa com P workers; devolve o tempo de parede em ms.
+static double run_job(const char* filename, int stream, int columnar, int sum_only, long* lines){
+    args = (WorkerArg*)_aligned_malloc(sizeof(WorkerArg)*P, 64);
+    reduce_done = malloc(sizeof(HANDLE)*P);
+    for (int i=0;i<P;i++){
+        memset(&args[i], 0, sizeof(WorkerArg));
+        args[i].filename = (char*)filename;
         args[i].hist_bins = HIST_BINS;
-        args[i].hist = calloc(HIST_BINS, sizeof(int));
         args[i].id = i;
-        ths[i] = CreateThread(NULL,0,worker,&args[i],0,NULL);
+        reduce_done[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
     }
 
-    WaitForMultipleObjects(P, ths, TRUE, INFINITE);
-    long long total_sum = 0;
-    int *hist = calloc(HIST_BINS, sizeof(int));
-    for (int i=0;i<P;i++){
-        total_sum += args[i].partial_sum;
-        for (int b=0;b<HIST_BINS;b++) hist[b] += args[i].hist[b];
-        free(args[i].hist);
+    double t0 = now_ms();
+    long total_lines = 0;
+    if (use_procs) {
+        total_lines = run_processes(filename, columnar);
+    } else if (stream) {
+        total_lines = run_stream(filename);
+    } else if (columnar) {
+        total_lines = run_columnar(filename, sum_only);
+    } else {
+        // conta linhas
+        FILE *f = fopen(filename,"r");
+        if (!f){ perror("fopen"); *lines = -1; return 0; }
+        char buf[256];
+        while (fgets(buf,sizeof(buf),f)) total_lines++;
+        fclose(f);
+
+        HANDLE *ths = malloc(sizeof(HANDLE)*P);
+        long per = total_lines / P;
+        for (int i=0;i<P;i++){
+            args[i].start_line = i*per;
+            args[i].end_line = (i==P-1) ? (total_lines-1) : ((i+1)*per -1);
+            ths[i] = CreateThread(NULL,0,worker,&args[i],0,NULL);
+        }
+        WaitForMultipleObjects(P, ths, TRUE, INFINITE);
+        for (int i=0;i<P;i++) CloseHandle(ths[i]);
+        free(ths);
+    }
+    *lines = total_lines;
+    return now_ms() - t0;
+}
+
+static void print_result(long total_lines){
+    // a redução em árvore já deixou o total em args[0]
+    WorkerArg* r = &args[0];
+    printf("Linhas=%ld Sum=%lld\n", total_lines, r->partial_sum);
+    if (hist_mode == HIST_RANGE) {
+        double width = ((double)hist_max - (double)hist_min) / HIST_BINS;
+        printf("Histograma [%lld, %lld) em %d bins de largura %.3f:\n", hist_min, hist_max, HIST_BINS, width);
+        for (int b=0;b<HIST_BINS;b++)
+            printf("bin %d [%.1f, %.1f): %lld\n", b, hist_min + b*width, hist_min + (b+1)*width, r->hist[b]);
+        printf("abaixo: %lld acima: %lld\n", r->under, r->over);
+    } else {
+        printf("Histograma (bins %d):\n", HIST_BINS);
+        for (int b=0;b<HIST_BINS;b++) printf("bin %d: %lld\n", b, r->hist[b]);
     }
+    if (r->st.n > 0) {
+        double var = r->st.n > 1 ? r->st.m2 / (r->st.n - 1) : 0.0;
+        printf("Min=%lld Max=%lld Media=%.3f Variancia=%.3f Desvio=%.3f\n",
+               r->st.min, r->st.max, r->st.mean, var, sqrt(var));
+        printf("Quantis (erro relativo < %.1f%%): p50=%.0f p90=%.0f p99=%.0f p99.9=%.0f\n",
+               100.0 / SK_SUB, stats_quantile(&r->st, 0.50), stats_quantile(&r->st, 0.90),
+               stats_quantile(&r->st, 0.99), stats_quantile(&r->st, 0.999));
+    }
+}
+
+int main(int argc, char** argv){
+    if (argc == 4 && strcmp(argv[1], "--converter") == 0) return convert_to_columnar(argv[2], argv[3]);
+    if (argc == 4 && strcmp(argv[1], "--proc-worker") == 0) return proc_worker_main(strtoul(argv[2], NULL, 10), atoi(argv[3]));
+    if (argc < 3){
+        printf("Usage: %s arquivo.txt|- P [--stream] [--bins N] [--faixa MIN:MAX] [--pin] [--sweep]\n", argv[0]);
+        printf("       %s arquivo.bin P [--soma]\n", argv[0]);
+        printf("       %s arquivo P --processos   (P processos com memoria compartilhada)\n", argv[0]);
+        printf("       %s --converter arquivo.txt arquivo.bin\n", argv[0]);
+        return 1;
+    }
+    char *filename = argv[1];
+    P = atoi(argv[2]); if (P<=0) P=1;
+    int stream = strcmp(filename, "-") == 0, sum_only = 0, sweep = 0;
+    for (int i=3;i<argc;i++){
+        if (strcmp(argv[i], "--stream") == 0) stream = 1;
+        else if (strcmp(argv[i], "--soma") == 0) sum_only = 1;
+        else if (strcmp(argv[i], "--pin") == 0) pin_threads = 1;
+        else if (strcmp(argv[i], "--sweep") == 0) sweep = 1;
+        else if (strcmp(argv[i], "--processos") == 0) use_procs = 1;
+        else if (strcmp(argv[i], "--bins") == 0 && i+1 < argc) HIST_BINS = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--faixa") == 0 && i+1 < argc) {
+            if (sscanf(argv[++i], "%lld:%lld", &hist_min, &hist_max) != 2 || hist_max <= hist_min) {
+                printf("Faixa invalida '%s' (use MIN:MAX com MIN < MAX)\n", argv[i]); return 1;
+            }
+            hist_mode = HIST_RANGE;
+        }
+    }
+    if (HIST_BINS < 1) HIST_BINS = 1;
+    int columnar = !stream && is_columnar(filename);
+    sum_only = sum_only && columnar;
+    if (pin_threads) topology_init();
+    if (use_procs && stream) { printf("--processos nao suporta streaming (a entrada so pode ser lida uma vez)\n"); return 1; }
+    if (use_procs) sum_only = 0;
 
-    printf("Linhas=%ld Sum=%lld\n", total_lines, total_sum);
-    printf("Histograma (bins %d):\n", HIST_BINS);
-    for (int b=0;b<HIST_BINS;b++) printf("bin %d: %d\n", b, hist[b]);
+    long total_lines;
+    if (sweep) {
+        if (strcmp(filename, "-") == 0) { printf("--sweep precisa de um arquivo (stdin so pode ser lido uma vez)\n"); return 1; }
+        int max_p = P;
+        double t1 = 0; long long sum1 = 0;
+        printf("%4s %12s %9s %11s %12s\n", "P", "tempo ms", "speedup", "eficiencia", "RSS MB");
+        for (int p=1; p<=max_p; p = (p*2 > max_p && p < max_p) ? max_p : p*2){
+            P = p;
+            // devolve as páginas do ponto anterior: a medida de cada P parte do mesmo piso
+            SetProcessWorkingSetSize(GetCurrentProcess(), (SIZE_T)-1, (SIZE_T)-1);
+            job_rss = 0;
+            double t = run_job(filename, stream, columnar, 0, &total_lines);
+            if (total_lines < 0) return 1;
+            if (p == 1) { t1 = t; sum1 = args[0].partial_sum; }
+            if (args[0].partial_sum != sum1) printf("ERRO: soma com P=%d difere de P=1\n", p);
+            // threads: working set do processo no fim das varreduras; processos: soma dos picos
+            // de cada worker (processos novos a cada P) mais o coordenador
+            SIZE_T rss = use_procs ? cur_rss() + child_rss_total : (SIZE_T)job_rss;
+            printf("%4d %12.1f %9.2f %10.1f%% %12.1f\n", p, t, t1 / t, 100.0 * t1 / (t * p),
+                   rss / (1024.0*1024.0));
+            free_job();
+        }
+        return 0;
+    }
 
-    free(hist); free(args); free(ths);
+    double t = run_job(filename, stream, columnar, sum_only, &total_lines);
+    if (total_lines < 0) return 1;
+    if (!sum_only) print_result(total_lines);
+    printf("Tempo=%.1f ms (P=%d%s%s)\n", t, P, use_procs ? " processos" : "", pin_threads ? ", fixados" : "");
+    if (use_procs)
+        printf("Pico RSS: coordenador %.1f MB + workers %.1f MB\n", peak_rss()/(1024.0*1024.0), child_rss_total/(1024.0*1024.0));
+    else
+        printf("Pico RSS: %.1f MB\n", peak_rss()/(1024.0*1024.0));
+    free_job();
     return 0;
 }
@@ -3,28 +3,89 @@
 // 1) ordem global de aquisição (pegar o garfo de menor índice primeiro)
 // 2) limitar simultâneos com um semáforo (N-1 solução classical)
 // Compila no Windows (MinGW / MSVC)
-// Uso: ex7_filosofos.exe [N_filosofo] [modo]
+// Uso: ex7_filosofos.exe [N_filosofo] [modo] [--trava cs|adaptativa|mcs] [--spin-us U] [--segundos s]
+//                        [--trabalho sleep|spin|mem] [--dist ...] [--fator f]
+//      ex7_filosofos.exe [N_filosofo] [modo] --varredura [--segundos s]
 // modo: 1 = ordem global (default), 2 = semaforo limitador
+// pensar, comer e descansar seguem o modelo de trabalho de workload.h (padrão: Sleep)
+//
+// Travas dos garfos (--trava):
+//   cs         - CRITICAL_SECTION (original); o limitador do modo 2 é um semáforo do kernel
+//   adaptativa - gira por um tempo limitado (calibrado na partida, no máximo --spin-us) e depois
+//                estaciona num evento; o limite de giro se adapta ao que as últimas esperas precisaram
+//   mcs        - fila MCS: cada filósofo espera no seu próprio nó e recebe o garfo em ordem FIFO
+//                (gira e depois estaciona, como a adaptativa)
+// Com adaptativa/mcs o limitador do modo 2 vira um semáforo com caminho rápido (contador Interlocked,
+// o kernel só entra quando alguém precisa esperar).
+// Mede refeições/s e a latência de passagem do garfo (liberação -> aquisição pelo filósofo que esperava).
+// --varredura: tempo de comer (e de pensar) de 100 ms até 1 us, em CPU calibrada, para cada trava.
+// Compilado com -DTRACE grava ex7_trace.json: espera por garfo, refeições e passagens (trace.h).
+
+#ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
+#endif
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include "rng.h"
+#include "workload.h"
+#include "trace.h"
+#include "cache.h"
 
 #define DEFAULT_N 5
 #define RUN_SECONDS 10
+#define HANDOFF_SAMPLES 4096    // amostras de passagem guardadas por filósofo (anel)
+
+typedef enum { LOCK_CS, LOCK_ADAPT, LOCK_MCS, N_LOCKS } LockKind;
+const char* lock_names[N_LOCKS] = { "cs", "adaptativa", "mcs" };
+
+// Nó da fila MCS: um por garfo que o filósofo segura (primeiro e segundo).
+typedef struct QNode {
+    CACHE_ALIGN struct QNode* volatile next;
+    volatile LONG locked;       // 1 enquanto espera a vez
+    volatile LONG parked;       // 1 se desistiu de girar e dorme em evt
+    HANDLE evt;
+} QNode;
+
+typedef struct {
+    CACHE_ALIGN CRITICAL_SECTION cs;   // LOCK_CS
+    volatile LONG state;        // LOCK_ADAPT: 0 livre, 1 ocupado, 2 ocupado com gente estacionada
+    LONG spin;                  // LOCK_ADAPT: giro estimado (só o dono atualiza)
+    HANDLE evt;                 // LOCK_ADAPT: onde se estaciona
+    QNode* volatile tail;       // LOCK_MCS
+    volatile double released_at;        // instante da última liberação (ms)
+} Fork;
 
 typedef struct {
     int id;
     int meals;
     double max_wait_ms;
     DWORD thread_id;
+    int contended;              // aquisições de garfo que tiveram de esperar
+    int handoffs;
+    double handoff_sum_us;
+    float *handoff_us;          // anel de HANDOFF_SAMPLES amostras
+    QNode nodes[2];
 } Philosopher;
 
-CRITICAL_SECTION *forks; // array of mutexes (CRITICAL_SECTION)
-HANDLE limiter = NULL;   // semaphore for mode 2
+// Semáforo com caminho rápido: o kernel só é chamado quando há espera de fato.
+typedef struct {
+    volatile LONG count;
+    HANDLE sem;
+} FastSem;
+
+Fork *forks;
+HANDLE limiter = NULL;   // semaphore for mode 2 (cs)
+FastSem fast_limiter;    // mode 2 (adaptativa/mcs)
 Philosopher *ph;
 int N = DEFAULT_N;
 int mode = 1;
+LockKind lock_kind = LOCK_CS;
+double spin_us = 50;            // giro máximo antes de estacionar
+LONG max_spin = 1000;           // spin_us em iterações de YieldProcessor (calibrado)
+double eat_ns = 0;              // > 0: varredura (pensar e comer em CPU calibrada)
 volatile LONG stop_flag = 0;
 
 // timing helper
@@ -36,78 +97,293 @@ static double now_ms() {
     return (double)t.QuadPart * 1000.0 / (double)freq.QuadPart;
 }
 
+// Custo de uma iteração de YieldProcessor -> limite de giro em iterações.
+static void calibrate_spin() {
+    const int n = 1 << 18;
+    double t0 = now_ms();
+    for (int i=0;i<n;i++) YieldProcessor();
+    double ns = (now_ms() - t0) * 1e6 / n;
+    max_spin = (LONG)(spin_us * 1000.0 / (ns > 0.1 ? ns : 0.1));
+    if (max_spin < 1) max_spin = 1;
+}
+
+// ---- trava adaptativa: gira, depois estaciona ----
+static int adapt_lock(Fork* f) {
+    if (InterlockedCompareExchange(&f->state, 1, 0) == 0) return 0;
+    LONG limit = f->spin * 2 + 16;
+    if (limit > max_spin) limit = max_spin;
+    for (LONG n=0; n<limit; n++) {
+        YieldProcessor();
+        if (f->state == 0 && InterlockedCompareExchange(&f->state, 1, 0) == 0) {
+            f->spin += (n - f->spin) / 8;
+            return 1;
+        }
+    }
+    // girar não bastou: estaciona e passa a girar menos nesta trava
+    while (InterlockedExchange(&f->state, 2) != 0) WaitForSingleObject(f->evt, INFINITE);
+    f->spin -= f->spin / 8;
+    return 1;
+}
+
+static void adapt_unlock(Fork* f) {
+    if (InterlockedExchange(&f->state, 0) == 2) SetEvent(f->evt);
+}
+
+// ---- fila MCS: cada um gira no próprio nó; passagem FIFO ----
+static int mcs_lock(Fork* f, QNode* me) {
+    me->next = NULL;
+    me->locked = 1;
+    me->parked = 0;
+    QNode* pred = (QNode*)InterlockedExchangePointer((PVOID volatile*)&f->tail, me);
+    if (!pred) return 0;
+    pred->next = me;
+    for (LONG n=0; n<max_spin && me->locked; n++) YieldProcessor();
+    if (me->locked) {
+        InterlockedExchange(&me->parked, 1);
+        while (me->locked) WaitForSingleObject(me->evt, INFINITE);
+    }
+    return 1;
+}
+
+static void mcs_unlock(Fork* f, QNode* me) {
+    if (!me->next) {
+        if (InterlockedCompareExchangePointer((PVOID volatile*)&f->tail, NULL, me) == me) return;
+        // o sucessor já entrou na fila mas ainda não se ligou a nós
+        for (int n=0; !me->next; n++) { if (n & 63) YieldProcessor(); else SwitchToThread(); }
+    }
+    QNode* next = me->next;
+    InterlockedExchange(&next->locked, 0);
+    if (next->parked) SetEvent(next->evt);
+}
+
+// Conta as aquisições contendidas e registra a passagem se o garfo foi liberado durante a espera.
+static void fork_lock(Philosopher* p, int i, QNode* node) {
+    Fork* f = &forks[i];
+    double t0 = now_ms();
+    int waited;
+    TRACE_BEGIN("garfo");
+    switch (lock_kind) {
+    case LOCK_ADAPT: waited = adapt_lock(f); break;
+    case LOCK_MCS:   waited = mcs_lock(f, node); break;
+    default:
+        waited = !TryEnterCriticalSection(&f->cs);
+        if (waited) EnterCriticalSection(&f->cs);
+        break;
+    }
+    TRACE_END("garfo");
+    if (!waited) return;
+    p->contended++;
+    double rel = f->released_at;
+    if (rel >= t0) {
+        double us = (now_ms() - rel) * 1000.0;
+        p->handoff_us[p->handoffs++ % HANDOFF_SAMPLES] = (float)us;
+        TRACE_INSTANT("passagem ns", us * 1000.0);
+        p->handoff_sum_us += us;
+    }
+}
+
+static void fork_unlock(int i, QNode* node) {
+    Fork* f = &forks[i];
+    f->released_at = now_ms();
+    switch (lock_kind) {
+    case LOCK_ADAPT: adapt_unlock(f); break;
+    case LOCK_MCS:   mcs_unlock(f, node); break;
+    default:         LeaveCriticalSection(&f->cs); break;
+    }
+}
+
+static void limiter_wait() {
+    if (lock_kind == LOCK_CS) { WaitForSingleObject(limiter, INFINITE); return; }
+    if (InterlockedDecrement(&fast_limiter.count) < 0) WaitForSingleObject(fast_limiter.sem, INFINITE);
+}
+
+static void limiter_post() {
+    if (lock_kind == LOCK_CS) { ReleaseSemaphore(limiter, 1, NULL); return; }
+    if (InterlockedIncrement(&fast_limiter.count) <= 0) ReleaseSemaphore(fast_limiter.sem, 1, NULL);
+}
+
 DWORD WINAPI philosopher_thread(LPVOID arg) {
     Philosopher *p = (Philosopher*)arg;
     int left = p->id;
     int right = (p->id + 1) % N;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), p->id);
+    Work w;
+    work_init(&w, p->id);
+    TRACE_THREAD("filosofo", p->id);
     while (!stop_flag) {
         // think
-        Sleep( (rand() % 50) + 20 );
+        if (eat_ns > 0) work_spin_ns(eat_ns);
+        else work_ms(&w, &rng, 20, 50);
 
         double t0 = now_ms();
 
+        int first, second;
         if (mode == 1) {
             // ordem global: adquira primeiro o garfo de menor índice
-            int first = left < right ? left : right;
-            int second = left < right ? right : left;
-            EnterCriticalSection(&forks[first]);
-            EnterCriticalSection(&forks[second]);
+            first = left < right ? left : right;
+            second = left < right ? right : left;
         } else {
             // modo 2: aguarda semaforo (N-1) e pega ambos (ordem arbitraria)
-            WaitForSingleObject(limiter, INFINITE);
-            EnterCriticalSection(&forks[left]);
-            EnterCriticalSection(&forks[right]);
+            limiter_wait();
+            first = left;
+            second = right;
         }
+        fork_lock(p, first, &p->nodes[0]);
+        fork_lock(p, second, &p->nodes[1]);
 
         double waited = now_ms() - t0;
         if (waited > p->max_wait_ms) p->max_wait_ms = waited;
 
         // eat
         p->meals++;
-        Sleep( (rand() % 80) + 20 );
+        TRACE_BEGIN("comendo");
+        if (eat_ns > 0) work_spin_ns(eat_ns);
+        else work_ms(&w, &rng, 20, 80);
+        TRACE_END("comendo");
 
         // release
-        LeaveCriticalSection(&forks[left]);
-        LeaveCriticalSection(&forks[right]);
-        if (mode == 2) ReleaseSemaphore(limiter, 1, NULL);
+        fork_unlock(second, &p->nodes[1]);
+        fork_unlock(first, &p->nodes[0]);
+        if (mode == 2) limiter_post();
 
         // short rest
-        Sleep( (rand() % 50) + 10 );
+        if (eat_ns <= 0) work_ms(&w, &rng, 10, 50);
     }
+    work_free(&w);
     return 0;
 }
 
-int main(int argc, char** argv) {
-    srand((unsigned)time(NULL));
-    if (argc >= 2) N = atoi(argv[1]) > 1 ? atoi(argv[1]) : DEFAULT_N;
-    if (argc >= 3) mode = atoi(argv[2]) == 2 ? 2 : 1;
+static int cmp_float(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double meals_per_s;
+    double contended_pct;
+    double handoff_avg_us, handoff_p99_us;
+} DinnerStats;
 
-    printf("Filósofos N=%d, modo=%d (%s)\n", N, mode, mode==1?"ordem global":"semáforo limitador (N-1)");
-    forks = (CRITICAL_SECTION*)malloc(sizeof(CRITICAL_SECTION) * N);
-    ph = (Philosopher*)malloc(sizeof(Philosopher) * N);
-    for (int i=0;i<N;i++) InitializeCriticalSection(&forks[i]);
-    if (mode == 2) limiter = CreateSemaphore(NULL, N-1, N-1, NULL);
+// Um jantar completo de `seconds` segundos com a trava atual (ph fica para o chamador liberar).
+DinnerStats run_dinner(double seconds) {
+    forks = (Fork*)_aligned_malloc(sizeof(Fork) * N, 64);
+    ph = (Philosopher*)_aligned_malloc(sizeof(Philosopher) * N, 64);
+    memset(ph, 0, sizeof(Philosopher) * N);
+    for (int i=0;i<N;i++) {
+        memset(&forks[i], 0, sizeof(Fork));
+        InitializeCriticalSection(&forks[i].cs);
+        forks[i].evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+    }
+    if (mode == 2) {
+        limiter = CreateSemaphore(NULL, N-1, N-1, NULL);
+        fast_limiter.count = N-1;
+        fast_limiter.sem = CreateSemaphore(NULL, 0, N, NULL);
+    }
+    stop_flag = 0;
 
     HANDLE *ths = (HANDLE*)malloc(sizeof(HANDLE)*N);
     for (int i=0;i<N;i++) {
         ph[i].id = i;
-        ph[i].meals = 0;
-        ph[i].max_wait_ms = 0.0;
+        ph[i].handoff_us = (float*)malloc(sizeof(float) * HANDOFF_SAMPLES);
+        for (int k=0;k<2;k++) ph[i].nodes[k].evt = CreateEvent(NULL, FALSE, FALSE, NULL);
         ths[i] = CreateThread(NULL,0,philosopher_thread,&ph[i],0,NULL);
     }
 
-    Sleep(RUN_SECONDS * 1000);
+    Sleep((DWORD)(seconds * 1000));
     InterlockedExchange(&stop_flag, 1);
     WaitForMultipleObjects(N, ths, TRUE, INFINITE);
 
+    DinnerStats st;
+    int meals = 0, contended = 0, handoffs = 0, kept = 0;
+    double sum = 0;
+    for (int i=0;i<N;i++) {
+        meals += ph[i].meals; contended += ph[i].contended;
+        handoffs += ph[i].handoffs; sum += ph[i].handoff_sum_us;
+        kept += ph[i].handoffs < HANDOFF_SAMPLES ? ph[i].handoffs : HANDOFF_SAMPLES;
+    }
+    float *all = (float*)malloc(sizeof(float) * (kept ? kept : 1));
+    kept = 0;
+    for (int i=0;i<N;i++) {
+        int n = ph[i].handoffs < HANDOFF_SAMPLES ? ph[i].handoffs : HANDOFF_SAMPLES;
+        memcpy(all + kept, ph[i].handoff_us, sizeof(float) * n);
+        kept += n;
+    }
+    qsort(all, kept, sizeof(float), cmp_float);
+    st.meals_per_s = meals / seconds;
+    st.contended_pct = meals ? 100.0 * contended / (2.0 * meals) : 0.0;
+    st.handoff_avg_us = handoffs ? sum / handoffs : 0.0;
+    st.handoff_p99_us = kept ? all[(int)(0.99 * (kept - 1))] : 0.0;
+    free(all);
+
+    for (int i=0;i<N;i++) {
+        CloseHandle(ths[i]);
+        DeleteCriticalSection(&forks[i].cs);
+        CloseHandle(forks[i].evt);
+        for (int k=0;k<2;k++) CloseHandle(ph[i].nodes[k].evt);
+        free(ph[i].handoff_us);
+    }
+    if (mode == 2) { CloseHandle(limiter); CloseHandle(fast_limiter.sem); }
+    _aligned_free(forks); free(ths);
+    return st;
+}
+
+int main(int argc, char** argv) {
+    rng_default_seed();
+    int pos = 0, sweep = 0;
+    double seconds = RUN_SECONDS;
+    for (int i=1;i<argc;i++) {
+        if (work_arg(argc, argv, &i)) continue;
+        if (strcmp(argv[i], "--varredura") == 0) { sweep = 1; seconds = 2; continue; }
+        if (strcmp(argv[i], "--segundos") == 0 && i+1 < argc) { seconds = atof(argv[++i]); continue; }
+        if (strcmp(argv[i], "--spin-us") == 0 && i+1 < argc) { spin_us = atof(argv[++i]); continue; }
+        if (strcmp(argv[i], "--trava") == 0 && i+1 < argc) {
+            const char* n = argv[++i];
+            int k;
+            for (k=0;k<N_LOCKS && strcmp(n, lock_names[k]);k++);
+            if (k == N_LOCKS) { printf("Trava desconhecida '%s' (cs, adaptativa, mcs)\n", n); return 1; }
+            lock_kind = (LockKind)k;
+            continue;
+        }
+        if (pos == 0) N = atoi(argv[i]) > 1 ? atoi(argv[i]) : DEFAULT_N;
+        else if (pos == 1) mode = atoi(argv[i]) == 2 ? 2 : 1;
+        pos++;
+    }
+    work_setup();
+    calibrate_spin();
+    if (seconds <= 0) seconds = RUN_SECONDS;
+
+    if (sweep) {
+        printf("Filósofos N=%d, modo=%d, %.1f s por ponto, giro max %.0f us (%ld iteracoes)\n",
+               N, mode, seconds, spin_us, (long)max_spin);
+        printf("%10s %-11s %14s %11s %14s %14s\n", "comer", "trava", "refeicoes/s", "contendidas", "passagem med", "passagem p99");
+        for (double e = 100e6; e >= 1e3 * 0.999; e /= 10) {
+            eat_ns = e;
+            for (int k=0;k<N_LOCKS;k++) {
+                lock_kind = (LockKind)k;
+                DinnerStats st = run_dinner(seconds);
+                _aligned_free(ph);
+                printf("%8.0f%s %-11s %14.0f %10.1f%% %11.1f us %11.1f us\n",
+                       e >= 1e6 ? e / 1e6 : e / 1e3, e >= 1e6 ? "ms" : "us", lock_names[k],
+                       st.meals_per_s, st.contended_pct, st.handoff_avg_us, st.handoff_p99_us);
+            }
+        }
+        TRACE_DUMP("ex7_trace.json");
+        return 0;
+    }
+
+    printf("Filósofos N=%d, modo=%d (%s), trava %s\n", N, mode, mode==1?"ordem global":"semáforo limitador (N-1)", lock_names[lock_kind]);
+    DinnerStats st = run_dinner(seconds);
+
     printf("\nResultados por filósofo:\n");
     for (int i=0;i<N;i++) {
         printf("Philosopher %d: meals=%d, max_wait=%.3f ms\n", i, ph[i].meals, ph[i].max_wait_ms);
     }
+    printf("Refeicoes/s: %.1f, aquisicoes contendidas: %.1f%%, passagem do garfo: media %.1f us, p99 %.1f us\n",
+           st.meals_per_s, st.contended_pct, st.handoff_avg_us, st.handoff_p99_us);
 
     // cleanup
-    for (int i=0;i<N;i++) DeleteCriticalSection(&forks[i]);
-    if (mode==2) CloseHandle(limiter);
-    free(forks); free(ph); free(ths);
+    _aligned_free(ph);
+    TRACE_DUMP("ex7_trace.json");
     return 0;
 }
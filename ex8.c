@@ -3,6 +3,9 @@
 // simula bursts (rajadas) e ócio, implementa backpressure (produtores aguardam)
 // Grava ocupação do buffer ao longo do tempo e imprime no final.
 // Windows API version.
+// Uso: ex8_buffer_bursts.exe [buffer] [produtores] [consumidores] [--trabalho sleep|spin|mem] [--dist ...] [--fator f]
+//      (intervalos dos produtores e processamento dos consumidores seguem workload.h; padrão: Sleep)
+//      compilado com -DTRACE grava ex8_trace.json (backpressure e ocupação; ver trace.h)
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
@@ -12,6 +15,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <time.h>
+#include "rng.h"
+#include "workload.h"
+#include "trace.h"
 
 
 #define DEFAULT_BUFFER 8
@@ -55,64 +61,91 @@ void rb_destroy(RingBuffer *r) {
 }
 
 void rb_put(RingBuffer *r, int item) {
+    TRACE_BEGIN("put");
     EnterCriticalSection(&r->cs);
-    while (r->count == r->capacity && !stop_flag) {
-        // backpressure: wait until not full
-        SleepConditionVariableCS(&r->not_full, &r->cs, INFINITE);
+    if (r->count == r->capacity && !stop_flag) {
+        TRACE_BEGIN("backpressure");
+        while (r->count == r->capacity && !stop_flag) {
+            // backpressure: wait until not full
+            SleepConditionVariableCS(&r->not_full, &r->cs, INFINITE);
+        }
+        TRACE_END("backpressure");
     }
-    if (stop_flag) { LeaveCriticalSection(&r->cs); return; }
+    if (stop_flag) { LeaveCriticalSection(&r->cs); TRACE_END("put"); return; }
     r->buf[r->tail] = item;
     r->tail = (r->tail+1)%r->capacity;
     r->count++;
+    TRACE_COUNTER("ocupacao", r->count);
     WakeConditionVariable(&r->not_empty);
     LeaveCriticalSection(&r->cs);
+    TRACE_END("put");
 }
 
 int rb_get(RingBuffer *r, int *out) {
+    TRACE_BEGIN("get");
     EnterCriticalSection(&r->cs);
-    while (r->count == 0 && !stop_flag) {
-        SleepConditionVariableCS(&r->not_empty, &r->cs, INFINITE);
+    if (r->count == 0 && !stop_flag) {
+        TRACE_BEGIN("espera vazio");
+        while (r->count == 0 && !stop_flag) {
+            SleepConditionVariableCS(&r->not_empty, &r->cs, INFINITE);
+        }
+        TRACE_END("espera vazio");
     }
-    if (r->count == 0 && stop_flag) { LeaveCriticalSection(&r->cs); return 0; }
+    if (r->count == 0 && stop_flag) { LeaveCriticalSection(&r->cs); TRACE_END("get"); return 0; }
     *out = r->buf[r->head];
     r->head = (r->head+1)%r->capacity;
     r->count--;
+    TRACE_COUNTER("ocupacao", r->count);
     WakeConditionVariable(&r->not_full);
     LeaveCriticalSection(&r->cs);
+    TRACE_END("get");
     return 1;
 }
 
 DWORD WINAPI producer(LPVOID arg) {
     int id = (int)(intptr_t)arg;
     int burst_chance = 20; // % chance to start a burst
+    TRACE_THREAD("produtor", id);
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);
+    Work w;
+    work_init(&w, id);
     while (!stop_flag) {
         // decide burst or idle
-        int r = rand()%100;
+        int r = rng_below(&rng, 100);
         if (r < burst_chance) {
             // burst: produce many quickly
-            int burst_len = 2 + rand()%5;
+            int burst_len = 2 + rng_below(&rng, 5);
+            TRACE_INSTANT("rajada", burst_len);
             for (int i=0;i<burst_len && !stop_flag;i++) {
-                rb_put(&rb, id*1000 + rand()%1000);
-                Sleep(10 + rand()%20); // quick
+                rb_put(&rb, id*1000 + rng_below(&rng, 1000));
+                work_ms(&w, &rng, 10, 20); // quick
             }
         } else {
             // idle: produce rarely
-            rb_put(&rb, id*1000 + rand()%1000);
-            Sleep(150 + rand()%300);
+            rb_put(&rb, id*1000 + rng_below(&rng, 1000));
+            work_ms(&w, &rng, 150, 300);
         }
     }
+    work_free(&w);
     return 0;
 }
 
 DWORD WINAPI consumer(LPVOID arg) {
     int id = (int)(intptr_t)arg;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), 1000 + id);
+    TRACE_THREAD("consumidor", id);
+    Work w;
+    work_init(&w, 1000 + id);
     while (!stop_flag) {
         int item;
         if (!rb_get(&rb, &item)) break;
         // process
-        Sleep(50 + rand()%100);
+        work_ms(&w, &rng, 50, 100);
         //printf("C%d consumed %d\n", id, item);
     }
+    work_free(&w);
     return 0;
 }
 
@@ -130,11 +163,18 @@ DWORD WINAPI sampler(LPVOID arg) {
 
 int main(int argc, char** argv) {
     int bufsize = DEFAULT_BUFFER;
-    if (argc >= 2) bufsize = atoi(argv[1])>1?atoi(argv[1]):DEFAULT_BUFFER;
-    if (argc >= 3) producers = atoi(argv[2])>0?atoi(argv[2]):DEFAULT_PRODS;
-    if (argc >= 4) consumers = atoi(argv[3])>0?atoi(argv[3]):DEFAULT_CONS;
+    int pos = 0;
+    for (int i=1;i<argc;i++) {
+        if (work_arg(argc, argv, &i)) continue;
+        int v = atoi(argv[i]);
+        if (pos == 0) bufsize = v>1?v:DEFAULT_BUFFER;
+        else if (pos == 1) producers = v>0?v:DEFAULT_PRODS;
+        else if (pos == 2) consumers = v>0?v:DEFAULT_CONS;
+        pos++;
+    }
 
-    srand((unsigned)time(NULL));
+    rng_default_seed();
+    work_setup();
     samples = (int*)malloc(sizeof(int)*(samples_capacity+10));
     rb_init(&rb, bufsize);
 
@@ -173,5 +213,6 @@ int main(int argc, char** argv) {
     CloseHandle(pSampler);
     rb_destroy(&rb);
     free(pth_prod); free(pth_cons); free(samples);
+    TRACE_DUMP("ex8_trace.json");
     return 0;
 }
@@ -4,6 +4,17 @@
 // Implementa barreira com mutex+condvar e mede rodadas por minuto.
 // Compila no Windows.
 // Uso: ex9_revezamento.exe [teams] [K_por_team] [duration_seconds]
+//      ex9_revezamento.exe [teams] [K] [s] --pool W [--perna-us U] [--global F] [--escala]
+//
+// Modo pool: os corredores viram tarefas num pool fixo de W threads. A barreira de cada equipe é
+// de continuação: o último corredor a chegar agenda a próxima perna da equipe, sem bloquear
+// thread nenhuma. Com --global F, as equipes ainda passam por uma árvore de barreiras (fan-in F)
+// sobre todas as equipes, e a raiz libera a próxima fase descendo a árvore. --escala repete
+// com 10, 100, 1000 e 10000 equipes e imprime pernas/s e overhead do escalonador.
+// As pernas e o descanso dos corredores seguem o modelo de trabalho de workload.h
+// (--trabalho sleep|spin|mem, --dist, --traco, --fator; padrão: Sleep); as pernas do pool
+// usam o spin calibrado de workload.h.
+// Compilado com -DTRACE grava ex9_trace.json: esperas na barreira, pernas e ociosidade do pool (trace.h).
 
 #ifndef _WIN32_WINNT
   #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
@@ -11,7 +22,12 @@
 #include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
 #include <time.h>
+#include "rng.h"
+#include "workload.h"
+#include "trace.h"
 
 typedef struct {
     int team;
@@ -41,38 +57,277 @@ void barrier_init(Barrier *b, int thr) {
 }
 
 void barrier_wait(Barrier *b) {
+    TRACE_BEGIN("barreira");
     EnterCriticalSection(&b->cs);
     b->count++;
     if (b->count >= b->threshold) {
         b->count = 0; // reset for next round
+        TRACE_INSTANT("libera", b->threshold);
         WakeAllConditionVariable(&b->cv);
     } else {
         SleepConditionVariableCS(&b->cv, &b->cs, INFINITE);
     }
     LeaveCriticalSection(&b->cs);
+    TRACE_END("barreira");
 }
 
 DWORD WINAPI runner_thread(LPVOID arg) {
     RunnerArg *ra = (RunnerArg*)arg;
     int team = ra->team;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), (uint64_t)team * K + ra->id);
+    Work w;
+    work_init(&w, (uint64_t)team * K + ra->id);
+    TRACE_THREAD("corredor", team * K + ra->id);
     while (!stop_flag) {
         // simulate running leg
-        Sleep(100 + rand()%200);
+        work_ms(&w, &rng, 100, 200);
         // reach barrier
         barrier_wait(&barriers[team]);
         // only one thread per team will increment rounds -- pick thread id==0
         if (ra->id == 0) rounds_completed[team]++;
         // small rest
-        Sleep(20);
+        work_ms(&w, &rng, 20, 0);
     }
+    work_free(&w);
     return 0;
 }
 
+// ------------------- modo pool: corredores como tarefas -------------------
+enum { PT_LEG, PT_RELEASE };
+typedef struct { int kind; int idx; } PTask;   // PT_LEG: idx = equipe; PT_RELEASE: idx = nó da árvore
+
+typedef struct {
+    volatile LONG arrived;      // corredores que já terminaram a perna desta rodada
+    int rounds;
+    char pad[56];               // uma equipe por linha de cache
+} Team;
+
+typedef struct {
+    volatile LONG arrived;      // filhos que já chegaram nesta fase
+    int parent;                 // -1 = raiz
+    int first, n;               // filhos: equipes (over_teams) ou nós first..first+n-1
+    int over_teams;
+} TreeNode;
+
+typedef struct {
+    long long legs;
+    double work_ms, idle_ms;
+    char pad[40];
+} PoolStats;
+
+typedef struct {
+    PTask *q;
+    int cap, head, count;
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cv;
+} TaskQueue;
+
+TaskQueue tq;
+Team *pteams;
+TreeNode *tree;
+int *team_leaf;             // nó folha de cada equipe
+int tree_root = -1;
+int pool_workers = 0, global_fanin = 0;
+double leg_us = 20;         // trabalho de CPU por perna (spin), em microssegundos
+volatile LONG global_phases = 0;
+PoolStats *pstats;
+
+void tq_push(const PTask *ts, int n) {
+    EnterCriticalSection(&tq.cs);
+    for (int i=0;i<n;i++) tq.q[(tq.head + tq.count++) % tq.cap] = ts[i];
+    if (n == 1) WakeConditionVariable(&tq.cv); else WakeAllConditionVariable(&tq.cv);
+    LeaveCriticalSection(&tq.cs);
+}
+
+// Devolve 0 quando a corrida terminou e não há mais tarefas.
+int tq_pop(PTask *out, double *idle) {
+    EnterCriticalSection(&tq.cs);
+    if (tq.count == 0 && !stop_flag) {
+        double t0 = now_ms();
+        TRACE_BEGIN("ocioso");
+        while (tq.count == 0 && !stop_flag) SleepConditionVariableCS(&tq.cv, &tq.cs, INFINITE);
+        TRACE_END("ocioso");
+        *idle += now_ms() - t0;
+    }
+    if (tq.count == 0) { LeaveCriticalSection(&tq.cs); return 0; }
+    *out = tq.q[tq.head];
+    tq.head = (tq.head + 1) % tq.cap;
+    tq.count--;
+    LeaveCriticalSection(&tq.cs);
+    return 1;
+}
+
+void schedule_team(int t) {
+    PTask legs[64];
+    int k = K < 64 ? K : 64;
+    for (int i=0;i<k;i++) { legs[i].kind = PT_LEG; legs[i].idx = t; }
+    tq_push(legs, k);
+}
+
+void node_arrive(int n) {
+    TreeNode *nd = &tree[n];
+    if (InterlockedIncrement(&nd->arrived) < nd->n) return;
+    nd->arrived = 0;
+    if (nd->parent >= 0) { node_arrive(nd->parent); return; }
+    // raiz: fase global concluída, libera descendo a árvore
+    LONG phase = InterlockedIncrement(&global_phases);
+    TRACE_INSTANT("fase global", phase);
+    if (stop_flag) return;
+    PTask r = { PT_RELEASE, n };
+    tq_push(&r, 1);
+}
+
+// Continuação da barreira da equipe: o último a chegar agenda a próxima rodada.
+void team_arrive(int t) {
+    Team *tm = &pteams[t];
+    if (InterlockedIncrement(&tm->arrived) < K) return;
+    tm->arrived = 0;
+    tm->rounds++;
+    TRACE_INSTANT("barreira equipe", t);
+    if (global_fanin) node_arrive(team_leaf[t]);
+    else if (!stop_flag) schedule_team(t);
+}
+
+void release_node(int n) {
+    TreeNode *nd = &tree[n];
+    if (stop_flag) return;
+    if (nd->over_teams) {
+        for (int i=0;i<nd->n;i++) schedule_team(nd->first + i);
+    } else {
+        PTask rs[64];
+        for (int i=0;i<nd->n;i++) { rs[i].kind = PT_RELEASE; rs[i].idx = nd->first + i; }
+        tq_push(rs, nd->n);
+    }
+}
+
+DWORD WINAPI pool_worker(LPVOID arg) {
+    PoolStats *st = &pstats[(int)(intptr_t)arg];
+    TRACE_THREAD("pool", (int)(intptr_t)arg);
+    PTask t;
+    while (tq_pop(&t, &st->idle_ms)) {
+        if (t.kind == PT_LEG) {
+            double t0 = now_ms();
+            TRACE_BEGIN("perna");
+            work_spin_ns(leg_us * 1000.0);
+            TRACE_END("perna");
+            st->work_ms += now_ms() - t0;
+            st->legs++;
+            team_arrive(t.idx);
+        } else {
+            release_node(t.idx);
+        }
+    }
+    return 0;
+}
+
+// Árvore de combinação com fan-in F: nível 1 agrupa equipes, cada nível acima agrupa o anterior.
+int build_tree(int nteams, int F) {
+    int total = 0, cnt = nteams;
+    do { cnt = (cnt + F - 1) / F; total += cnt; } while (cnt > 1);
+    tree = (TreeNode*)calloc(total, sizeof(TreeNode));
+    team_leaf = (int*)malloc(sizeof(int)*nteams);
+    int base = 0, below = nteams, below_base = 0, over_teams = 1;
+    do {
+        cnt = (below + F - 1) / F;
+        for (int i=0;i<cnt;i++) {
+            TreeNode *nd = &tree[base + i];
+            nd->parent = -1;
+            nd->over_teams = over_teams;
+            nd->first = (over_teams ? 0 : below_base) + i*F;
+            nd->n = (below - i*F) < F ? (below - i*F) : F;
+            for (int c=0;c<nd->n;c++) {
+                if (over_teams) team_leaf[i*F + c] = base + i;
+                else tree[below_base + i*F + c].parent = base + i;
+            }
+        }
+        below_base = base; below = cnt; base += cnt; over_teams = 0;
+    } while (cnt > 1);
+    tree_root = base - 1;
+    return total;
+}
+
+// Executa a corrida no pool por 'seconds' segundos; imprime uma linha (tabela) ou o relatório completo.
+void run_pool(int nteams, int seconds, int table) {
+    int nodes = global_fanin ? build_tree(nteams, global_fanin) : 0;
+    pteams = (Team*)_aligned_malloc(sizeof(Team)*nteams, 64);
+    memset(pteams, 0, sizeof(Team)*nteams);
+    pstats = (PoolStats*)calloc(pool_workers, sizeof(PoolStats));
+    tq.cap = nteams*K + nodes + 16;
+    tq.q = (PTask*)malloc(sizeof(PTask)*tq.cap);
+    tq.head = tq.count = 0;
+    InitializeCriticalSection(&tq.cs);
+    InitializeConditionVariable(&tq.cv);
+    stop_flag = 0; global_phases = 0;
+    teams = nteams;
+
+    HANDLE *ths = (HANDLE*)malloc(sizeof(HANDLE)*pool_workers);
+    double t0 = now_ms();
+    for (int w=0;w<pool_workers;w++) ths[w] = CreateThread(NULL,0,pool_worker,(LPVOID)(intptr_t)w,0,NULL);
+    for (int t=0;t<nteams;t++) schedule_team(t);
+
+    Sleep(seconds * 1000);
+    EnterCriticalSection(&tq.cs);
+    InterlockedExchange(&stop_flag, 1);
+    WakeAllConditionVariable(&tq.cv);
+    LeaveCriticalSection(&tq.cs);
+    for (int w=0;w<pool_workers;w++) { WaitForSingleObject(ths[w], INFINITE); CloseHandle(ths[w]); }
+    double wall = now_ms() - t0;
+
+    long long legs = 0; double work = 0, idle = 0, rounds = 0;
+    for (int w=0;w<pool_workers;w++) { legs += pstats[w].legs; work += pstats[w].work_ms; idle += pstats[w].idle_ms; }
+    for (int t=0;t<nteams;t++) rounds += pteams[t].rounds;
+    double capacity = wall * pool_workers;
+    // overhead: tempo de worker que não foi perna nem espera ociosa (fila, barreiras, agendamento)
+    double overhead_us = legs ? (capacity - work - idle) * 1000.0 / legs : 0;
+    if (table) {
+        printf("%8d %12lld %12.0f %10.1f %8.1f%% %12.2f\n", nteams, legs, legs * 1000.0 / wall,
+               rounds / nteams, 100.0 * idle / capacity, overhead_us);
+    } else {
+        printf("\nPool: %d workers, %d equipes x %d, perna=%.1f us, barreira global: ", pool_workers, nteams, K, leg_us);
+        if (global_fanin) printf("fan-in %d (%d fases)\n", global_fanin, (int)global_phases); else printf("nao\n");
+        printf("pernas=%lld  pernas/s=%.0f  rodadas por equipe=%.1f (rpm ~= %.2f)\n", legs, legs * 1000.0 / wall,
+               rounds / nteams, rounds / nteams / (wall / 60000.0));
+        printf("trabalho=%.1f%%  ocioso=%.1f%%  overhead do escalonador=%.2f us por perna\n",
+               100.0 * work / capacity, 100.0 * idle / capacity, overhead_us);
+    }
+
+    DeleteCriticalSection(&tq.cs);
+    free(tq.q); free(ths); free(pstats); _aligned_free(pteams);
+    if (tree) { free(tree); free(team_leaf); tree = NULL; team_leaf = NULL; }
+}
+
 int main(int argc, char** argv) {
-    srand((unsigned)time(NULL));
-    if (argc >= 2) teams = atoi(argv[1])>0?atoi(argv[1]):teams;
-    if (argc >= 3) K = atoi(argv[2])>0?atoi(argv[2]):K;
-    if (argc >= 4) duration_seconds = atoi(argv[3])>0?atoi(argv[3]):duration_seconds;
+    rng_default_seed();
+    int pos = 0, sweep = 0;
+    for (int i=1;i<argc;i++) {
+        if (strcmp(argv[i], "--pool") == 0 && i+1 < argc) pool_workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--perna-us") == 0 && i+1 < argc) leg_us = atof(argv[++i]);
+        else if (strcmp(argv[i], "--global") == 0 && i+1 < argc) global_fanin = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--escala") == 0) sweep = 1;
+        else if (work_arg(argc, argv, &i)) continue;
+        else {
+            int v = atoi(argv[i]);
+            if (pos == 0) teams = v>0?v:teams;
+            else if (pos == 1) K = v>0?v:K;
+            else if (pos == 2) duration_seconds = v>0?v:duration_seconds;
+            pos++;
+        }
+    }
+    work_setup();
+    if (global_fanin == 1) global_fanin = 2;
+    if (global_fanin > 64) global_fanin = 64;
+    if (K > 64 && pool_workers > 0) K = 64;
+
+    if (pool_workers > 0) {
+        if (!sweep) { run_pool(teams, duration_seconds, 0); TRACE_DUMP("ex9_trace.json"); return 0; }
+        printf("Pool: %d workers, K=%d, perna=%.1f us, %d s por ponto, barreira global: %s\n",
+               pool_workers, K, leg_us, duration_seconds, global_fanin ? "sim" : "nao");
+        printf("%8s %12s %12s %10s %9s %12s\n", "equipes", "pernas", "pernas/s", "rodadas", "ocioso", "overhead us");
+        for (int n=10;n<=10000;n*=10) run_pool(n, duration_seconds, 1);
+        TRACE_DUMP("ex9_trace.json");
+        return 0;
+    }
 
     printf("Revezamento: %d equipes, %d corredores por equipe, duracao %d s\n", teams, K, duration_seconds);
     barriers = (Barrier*)malloc(sizeof(Barrier)*teams);
@@ -103,5 +358,6 @@ int main(int argc, char** argv) {
 
     // cleanup
     free(barriers); free(rounds_completed); free(threads); free(args);
+    TRACE_DUMP("ex9_trace.json");
     return 0;
 }
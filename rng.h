@@ -0,0 +1,77 @@
+// rng.h
+// Gerador pseudoaleatório por thread (PCG32, O'Neill) compartilhado pelos exercícios.
+// Cada thread tem seu próprio Rng: nada de estado global como rand(), nada de lock.
+// rng_seed(r, semente, fluxo) cria fluxos independentes (o fluxo escolhe o incremento do LCG),
+// então a mesma semente + o mesmo número de fluxo reproduzem a mesma sequência.
+// A semente padrão vem da variável de ambiente SEMENTE (execução reproduzível) ou do relógio.
+//
+// Só cabeçalho: basta #include "rng.h" (os exercícios continuam compilando com um único .c).
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t state;
+    uint64_t inc;       // sempre ímpar; define o fluxo
+} Rng;
+
+static inline uint32_t rng_next(Rng* r){
+    uint64_t old = r->state;
+    r->state = old * 6364136223846793005ULL + r->inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+static inline void rng_seed(Rng* r, uint64_t seed, uint64_t stream){
+    r->state = 0;
+    r->inc = (stream << 1) | 1;
+    rng_next(r);
+    r->state += seed;
+    rng_next(r);
+}
+
+// Inteiro uniforme em [0, n) sem o viés de "% n" (método de Lemire: multiplicação + rejeição).
+static inline uint32_t rng_below(Rng* r, uint32_t n){
+    if (n == 0) return 0;
+    uint64_t m = (uint64_t)rng_next(r) * n;
+    uint32_t low = (uint32_t)m;
+    if (low < n) {
+        uint32_t threshold = (0u - n) % n;
+        while (low < threshold) {
+            m = (uint64_t)rng_next(r) * n;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+// Inteiro uniforme em [lo, hi].
+static inline int rng_range(Rng* r, int lo, int hi){
+    return lo + (int)rng_below(r, (uint32_t)(hi - lo) + 1);
+}
+
+// Real uniforme em [0, 1).
+static inline double rng_double(Rng* r){
+    return rng_next(r) * (1.0 / 4294967296.0);
+}
+
+// SEMENTE=<n> no ambiente fixa a semente de todos os fluxos; senão usa o relógio.
+// A primeira chamada fixa o valor e não é protegida por lock: os programas chamam
+// rng_default_seed() no início do main, antes de criar threads, e as threads só leem o valor pronto.
+static uint64_t rng_default_seed(void){
+    static uint64_t seed = 0;
+    static int ready = 0;
+    if (!ready) {
+        const char* env = getenv("SEMENTE");
+        seed = env ? strtoull(env, NULL, 10) : (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+        ready = 1;
+    }
+    return seed;
+}
+
+#endif
@@ -0,0 +1,67 @@
+// rng_bench.c
+// Microbenchmark do rng.h: T threads geram números aleatórios com rand() (estado compartilhado
+// da CRT) e com um Rng por thread, para T = 1, 2, 4, ... 64. Imprime milhões de números/s e a
+// escala relativa a T=1 de cada gerador.
+//
+// Compilar: cl rng_bench.c  OR  gcc -O2 -o rng_bench.exe rng_bench.c
+// Uso:      rng_bench.exe [numeros_por_thread]
+
+#ifndef _WIN32_WINNT
+  #define _WIN32_WINNT 0x0600   /* Windows Vista / Server 2008 or newer */
+#endif
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "rng.h"
+
+#define MAX_THREADS 64
+
+int per_thread = 2000000;
+int use_rng = 0;
+HANDLE start_evt;
+volatile unsigned sink[MAX_THREADS * 16];   // impede que o laço seja eliminado (uma linha por thread)
+
+static double now_ms() { LARGE_INTEGER f,t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart*1000.0/(double)f.QuadPart; }
+
+DWORD WINAPI gen_thread(LPVOID arg){
+    int id = (int)(intptr_t)arg;
+    unsigned acc = 0;
+    Rng rng;
+    rng_seed(&rng, rng_default_seed(), id);
+    WaitForSingleObject(start_evt, INFINITE);
+    if (use_rng) for (int i=0;i<per_thread;i++) acc += rng_below(&rng, 1000);
+    else         for (int i=0;i<per_thread;i++) acc += rand() % 1000;
+    sink[id * 16] = acc;
+    return 0;
+}
+
+// Devolve milhões de números por segundo com T threads.
+double run(int T){
+    HANDLE th[MAX_THREADS];
+    start_evt = CreateEvent(NULL, TRUE, FALSE, NULL);
+    for (int i=0;i<T;i++) th[i] = CreateThread(NULL,0,gen_thread,(LPVOID)(intptr_t)i,0,NULL);
+    Sleep(10);
+    double t0 = now_ms();
+    SetEvent(start_evt);
+    WaitForMultipleObjects(T, th, TRUE, INFINITE);
+    double ms = now_ms() - t0;
+    for (int i=0;i<T;i++) CloseHandle(th[i]);
+    CloseHandle(start_evt);
+    return (double)T * per_thread / (ms * 1000.0);
+}
+
+int main(int argc, char** argv){
+    if (argc >= 2 && atoi(argv[1]) > 0) per_thread = atoi(argv[1]);
+    rng_default_seed();
+    srand(1);
+    printf("%4s %14s %9s %14s %9s\n", "T", "rand() M/s", "escala", "Rng M/s", "escala");
+    double base_rand = 0, base_rng = 0;
+    for (int T=1; T<=MAX_THREADS; T*=2){
+        use_rng = 0; double a = run(T);
+        use_rng = 1; double b = run(T);
+        if (T == 1) { base_rand = a; base_rng = b; }
+        printf("%4d %14.1f %8.2fx %14.1f %8.2fx\n", T, a, a / base_rand, b, b / base_rng);
+    }
+    return 0;
+}
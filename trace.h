@@ -0,0 +1,189 @@
+// trace.h
+// Rastreamento de eventos nos caminhos quentes, exportado no formato JSON de trace do Chrome
+// (abrir em chrome://tracing ou ui.perfetto.dev): linhas do tempo de bloqueios, esperas por
+// travas, movimentação de itens e buracos de ociosidade.
+//
+// Ligado só em tempo de compilação: cl /DTRACE ...  OR  gcc -DTRACE ...
+// Sem TRACE as macros viram expressões vazias e nada é compilado nos caminhos quentes.
+//
+// Cada thread escreve num anel próprio (sem lock e sem Interlocked: um único escritor), criado
+// na primeira emissão. O anel guarda os últimos TRACE_RING_EVENTS eventos (gravador de voo).
+// O carimbo de tempo é o TSC (__rdtsc), convertido para microssegundos na exportação com uma
+// calibração contra o QueryPerformanceCounter; fora de x86/x64 usa o próprio QPC.
+// Os nomes dos eventos devem ser literais (só o ponteiro é guardado).
+//
+//   TRACE_BEGIN("nome") / TRACE_END("nome")   intervalo (ex.: espera numa fila ou trava)
+//   TRACE_INSTANT("nome", v)                  evento pontual com um valor
+//   TRACE_COUNTER("nome", v)                  série numérica (ex.: ocupação do buffer)
+//   TRACE_THREAD("papel", id)                 nomeia a thread corrente na linha do tempo
+//   TRACE_DUMP("arquivo.json")                exporta (a variável TRACE_ARQUIVO tem precedência);
+//                                             chamar depois que as threads terminaram
+//
+// Só cabeçalho, como rng.h.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef TRACE
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <x86intrin.h>
+  #endif
+  #define TRACE_CLOCK() (uint64_t)__rdtsc()
+#else
+  static inline uint64_t trace_qpc(void){ LARGE_INTEGER t; QueryPerformanceCounter(&t); return (uint64_t)t.QuadPart; }
+  #define TRACE_CLOCK() trace_qpc()
+#endif
+#ifdef _MSC_VER
+  #define TRACE_TLS __declspec(thread)
+#else
+  #define TRACE_TLS __thread
+#endif
+
+#ifndef TRACE_RING_EVENTS
+  #define TRACE_RING_EVENTS (1 << 14)      // potência de 2
+#endif
+#ifndef TRACE_MAX_THREADS
+  #define TRACE_MAX_THREADS 1024
+#endif
+
+typedef struct {
+    uint64_t ts;
+    const char* name;
+    int64_t arg;
+    char ph;                    // 'B', 'E', 'i', 'C' (fases do formato do Chrome)
+} TraceEvent;
+
+typedef struct {
+    uint64_t head;              // total de eventos escritos (o anel guarda os últimos)
+    DWORD os_tid;
+    char label[32];
+    TraceEvent ev[TRACE_RING_EVENTS];
+} TraceRing;
+
+static TraceRing* volatile trace_rings[TRACE_MAX_THREADS];     // NULL até a thread publicar o anel
+static volatile LONG trace_nrings = 0;                          // slots reservados (<= TRACE_MAX_THREADS)
+static TRACE_TLS TraceRing* trace_mine = NULL;
+static TRACE_TLS int trace_off = 0;     // sem slot ou sem memória: esta thread não rastreia mais
+static uint64_t trace_t0 = 0;
+static LONGLONG trace_qpc0 = 0;
+
+// Reserva um slot uma única vez por thread. Esgotados os slots (threads que vão e vêm, como os
+// workers elásticos do ex5, gastam um cada), a thread marca trace_off e não volta a disputar o contador.
+static TraceRing* trace_ring(void){
+    if (trace_mine) return trace_mine;
+    if (trace_off) return NULL;
+    LONG i;
+    do {
+        i = trace_nrings;
+        if (i >= TRACE_MAX_THREADS) { trace_off = 1; return NULL; }
+    } while (InterlockedCompareExchange(&trace_nrings, i + 1, i) != i);
+    TraceRing* r = (TraceRing*)calloc(1, sizeof(TraceRing));
+    if (!r) { trace_off = 1; return NULL; }    // o slot fica vazio; trace_dump o pula
+    r->os_tid = GetCurrentThreadId();
+    snprintf(r->label, sizeof(r->label), "thread %lu", (unsigned long)r->os_tid);
+    if (i == 0) {
+        LARGE_INTEGER q; QueryPerformanceCounter(&q);
+        trace_qpc0 = q.QuadPart;
+        trace_t0 = TRACE_CLOCK();
+    }
+    InterlockedExchangePointer((PVOID volatile*)&trace_rings[i], r);    // publica já inicializado
+    trace_mine = r;
+    return r;
+}
+
+static inline void trace_emit(char ph, const char* name, int64_t arg){
+    TraceRing* r = trace_mine ? trace_mine : trace_off ? NULL : trace_ring();
+    if (!r) return;
+    TraceEvent* e = &r->ev[r->head & (TRACE_RING_EVENTS - 1)];
+    e->ts = TRACE_CLOCK();
+    e->name = name;
+    e->arg = arg;
+    e->ph = ph;
+    r->head++;
+}
+
+static void trace_thread_name(const char* role, int id){
+    TraceRing* r = trace_ring();
+    if (r) snprintf(r->label, sizeof(r->label), "%s %d", role, id);
+}
+
+// Ticks do relógio por microssegundo, medidos contra o QPC desde o primeiro evento.
+static double trace_ticks_per_us(void){
+    LARGE_INTEGER f, q;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&q);
+    uint64_t t = TRACE_CLOCK();
+    double us = (double)(q.QuadPart - trace_qpc0) * 1e6 / (double)f.QuadPart;
+    if (us < 1000.0) { Sleep(10); return trace_ticks_per_us(); }
+    return (double)(t - trace_t0) / us;
+}
+
+static void trace_dump(const char* path){
+    const char* env = getenv("TRACE_ARQUIVO");
+    if (env) path = env;
+    LONG n = trace_nrings;
+    if (n == 0) return;
+    FILE* f = fopen(path, "w");
+    if (!f) { printf("trace: nao foi possivel criar '%s'\n", path); return; }
+    double tpu = trace_ticks_per_us();
+    DWORD pid = GetCurrentProcessId();
+    uint64_t total = 0, lost = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    int first = 1, shown = 0;
+    for (LONG t=0;t<n;t++) {
+        TraceRing* r = trace_rings[t];
+        if (!r) continue;       // reservado mas ainda não publicado (dump com threads vivas) ou sem memória
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", (unsigned long)pid, (long)t, r->label);
+        first = 0;
+        shown++;
+        uint64_t begin = r->head > TRACE_RING_EVENTS ? r->head - TRACE_RING_EVENTS : 0;
+        int depth = 0;
+        for (uint64_t k=begin;k<r->head;k++) {
+            TraceEvent* e = &r->ev[k & (TRACE_RING_EVENTS - 1)];
+            if (e->ph == 'E') { if (depth == 0) continue; depth--; }    // início perdido na volta do anel
+            if (e->ph == 'B') depth++;
+            double ts = (double)(int64_t)(e->ts - trace_t0) / tpu;
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%ld",
+                    e->name, e->ph, ts, (unsigned long)pid, (long)t);
+            if (e->ph == 'C') fprintf(f, ",\"args\":{\"valor\":%lld}", (long long)e->arg);
+            else if (e->ph == 'i') fprintf(f, ",\"s\":\"t\",\"args\":{\"v\":%lld}", (long long)e->arg);
+            fprintf(f, "}");
+        }
+        total += r->head;
+        lost += begin;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("trace: %llu eventos de %ld threads em %s", (unsigned long long)(total - lost), (long)shown, path);
+    if (lost) printf(" (%llu mais antigos sobrescritos)", (unsigned long long)lost);
+    printf("\n");
+}
+
+#define TRACE_BEGIN(n)      trace_emit('B', (n), 0)
+#define TRACE_END(n)        trace_emit('E', (n), 0)
+#define TRACE_INSTANT(n, v) trace_emit('i', (n), (int64_t)(v))
+#define TRACE_COUNTER(n, v) trace_emit('C', (n), (int64_t)(v))
+#define TRACE_THREAD(r, id) trace_thread_name((r), (id))
+#define TRACE_DUMP(path)    trace_dump(path)
+
+#else
+
+#define TRACE_BEGIN(n)      ((void)0)
+#define TRACE_END(n)        ((void)0)
+#define TRACE_INSTANT(n, v) ((void)sizeof(v))     // não avalia; só evita "variável não usada"
+#define TRACE_COUNTER(n, v) ((void)sizeof(v))
+#define TRACE_THREAD(r, id) ((void)0)
+#define TRACE_DUMP(path)    ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+// workload.h
+// Modelo de trabalho simulado compartilhado pelos exercícios (substitui os Sleep(x + rand()%y)).
+// Sleep tem granularidade de milissegundos (e do timer do sistema): esconde todo o custo de
+// sincronização, e o benchmark acaba medindo o relógio do SO em vez do nosso código.
+//
+// Cada ponto de trabalho continua descrito como antes, "lo + [0, span) ms", e o modelo decide
+// como executá-lo:
+//   --trabalho sleep|spin|mem   sleep = comportamento original; spin = CPU calibrada na partida
+//                               (N ns viram um número fixo de iterações); mem = toca linhas de cache
+//                               de um buffer privado de --pegada KB pelo mesmo tempo calibrado
+//   --dist atual|fixo|exp|pareto  tempo de serviço: atual = uniforme em [lo, lo+span) como antes;
+//                               os demais mantêm a média do ponto (exp = exponencial, pareto com
+//                               forma --pareto-alfa, cauda pesada)
+//   --traco arq                 reproduz tempos de serviço de um arquivo (um número por linha);
+//                               os valores são normalizados para média 1 e escalados pela média do
+//                               ponto, então produtor e consumidor mantêm suas proporções
+//   --fator f                   multiplica todas as durações (ex.: 0.001 transforma ms em us)
+//
+// Só cabeçalho, como rng.h: o programa chama work_arg() no laço de argumentos, work_setup() antes
+// de criar threads e mantém um Work por thread (posição no traço e buffer de memória).
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "rng.h"
+
+typedef enum { WORK_SLEEP, WORK_SPIN, WORK_MEM } WorkKind;
+typedef enum { DIST_ATUAL, DIST_FIXO, DIST_EXP, DIST_PARETO, DIST_TRACO } WorkDist;
+
+static const char* work_kind_names[] = { "sleep", "spin", "mem" };
+static const char* work_dist_names[] = { "atual", "fixo", "exp", "pareto", "traco" };
+
+static WorkKind work_kind = WORK_SLEEP;
+static WorkDist work_dist = DIST_ATUAL;
+static double work_factor = 1.0;
+static double work_pareto_alpha = 1.5;
+static size_t work_footprint = 256 * 1024;
+static const char* work_trace_path = NULL;
+static double* work_trace = NULL;               // amostras normalizadas (média 1)
+static size_t work_trace_n = 0;
+static double work_iters_per_ns = 1.0;          // calibração do spin
+static double work_lines_per_ns = 0.1;          // calibração do toque de memória
+static volatile uint32_t work_sink;
+
+#define WORK_LINE 64
+#define WORK_STRIDE 97                          // passo em linhas (primo): foge do prefetcher
+static size_t work_stride = WORK_STRIDE;        // coprimo com o número de linhas (work_setup)
+
+// Estado por thread.
+typedef struct {
+    size_t trace_pos;
+    unsigned char* mem;
+    size_t mem_pos;
+} Work;
+
+static inline uint32_t work_spin_iters(uint64_t n, uint32_t x){
+    while (n--) x = x * 1664525u + 1013904223u;    // cadeia dependente: não vetoriza nem some
+    return x;
+}
+
+static inline size_t work_touch_lines(unsigned char* buf, size_t pos, uint64_t n){
+    size_t lines = work_footprint / WORK_LINE;
+    while (n--) {
+        pos += work_stride;
+        if (pos >= lines) pos -= lines;
+        buf[pos * WORK_LINE]++;
+    }
+    return pos;
+}
+
+static double work_now_ns(void){
+    LARGE_INTEGER f, t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t);
+    return (double)t.QuadPart * 1e9 / (double)f.QuadPart;
+}
+
+// CPU pura por ~ns nanossegundos (iterações calibradas; não consulta o relógio).
+static inline void work_spin_ns(double ns){
+    if (ns <= 0) return;
+    work_sink = work_spin_iters((uint64_t)(ns * work_iters_per_ns), work_sink);
+}
+
+static inline void work_mem_ns(Work* w, double ns){
+    if (ns <= 0) return;
+    if (!w->mem) w->mem = (unsigned char*)calloc(work_footprint, 1);
+    w->mem_pos = work_touch_lines(w->mem, w->mem_pos, (uint64_t)(ns * work_lines_per_ns));
+}
+
+static int work_load_trace(const char* path){
+    FILE* f = fopen(path, "r");
+    if (!f) { printf("Nao foi possivel abrir o traco '%s'\n", path); return 0; }
+    size_t cap = 1024;
+    double sum = 0, v;
+    work_trace = (double*)malloc(sizeof(double) * cap);
+    while (fscanf(f, "%lf", &v) == 1) {
+        if (v < 0) continue;
+        if (work_trace_n == cap) { cap *= 2; work_trace = (double*)realloc(work_trace, sizeof(double) * cap); }
+        work_trace[work_trace_n++] = v;
+        sum += v;
+    }
+    fclose(f);
+    if (work_trace_n == 0 || sum <= 0) { printf("Traco '%s' vazio\n", path); return 0; }
+    for (size_t i=0;i<work_trace_n;i++) work_trace[i] *= (double)work_trace_n / sum;
+    return 1;
+}
+
+// Consome argv[*i] (e o valor seguinte) se for uma opção do modelo; devolve 1 se consumiu.
+static int work_arg(int argc, char** argv, int* i){
+    const char* a = argv[*i];
+    if (*i + 1 >= argc) return 0;
+    const char* v = argv[*i + 1];
+    if (strcmp(a, "--trabalho") == 0) {
+        int k;
+        for (k=0;k<3 && strcmp(v, work_kind_names[k]);k++);
+        if (k == 3) { printf("Modelo de trabalho desconhecido '%s' (sleep, spin, mem)\n", v); exit(1); }
+        work_kind = (WorkKind)k;
+    } else if (strcmp(a, "--dist") == 0) {
+        int d;
+        for (d=0;d<DIST_TRACO && strcmp(v, work_dist_names[d]);d++);
+        if (d == DIST_TRACO) { printf("Distribuicao desconhecida '%s' (atual, fixo, exp, pareto)\n", v); exit(1); }
+        work_dist = (WorkDist)d;
+    } else if (strcmp(a, "--traco") == 0) {
+        work_trace_path = v;
+        work_dist = DIST_TRACO;
+    } else if (strcmp(a, "--fator") == 0) {
+        work_factor = atof(v);
+    } else if (strcmp(a, "--pegada") == 0) {
+        work_footprint = (size_t)atoi(v) * 1024;
+    } else if (strcmp(a, "--pareto-alfa") == 0) {
+        work_pareto_alpha = atof(v);
+    } else {
+        return 0;
+    }
+    (*i)++;
+    return 1;
+}
+
+static size_t work_gcd(size_t a, size_t b){
+    while (b) { size_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+// Calibra spin e memória e carrega o traço; chamar uma vez, antes de criar threads.
+static void work_setup(void){
+    if (work_pareto_alpha <= 1.0) work_pareto_alpha = 1.5;      // média finita
+    if (work_footprint < WORK_LINE * (WORK_STRIDE + 1)) work_footprint = WORK_LINE * (WORK_STRIDE + 1);
+    // com passo e linhas não coprimos o passeio fica num subconjunto das linhas (97 KB: uma só)
+    size_t lines = work_footprint / WORK_LINE;
+    for (work_stride = WORK_STRIDE; work_gcd(work_stride, lines) != 1; work_stride += 2);
+    if (work_dist == DIST_TRACO && !work_load_trace(work_trace_path)) exit(1);
+
+    // spin: o melhor de 3 rodadas de 2^20 iterações
+    double best = 1e30;
+    for (int r=0;r<3;r++) {
+        double t0 = work_now_ns();
+        work_sink = work_spin_iters(1 << 20, work_sink);
+        double dt = work_now_ns() - t0;
+        if (dt < best) best = dt;
+    }
+    work_iters_per_ns = (double)(1 << 20) / best;
+
+    if (work_kind == WORK_MEM) {
+        unsigned char* buf = (unsigned char*)calloc(work_footprint, 1);
+        size_t lines = work_footprint / WORK_LINE, pos = 0;
+        uint64_t n = lines * 4 > (1 << 18) ? lines * 4 : (1 << 18);
+        pos = work_touch_lines(buf, pos, lines);                 // aquece (falhas de página)
+        double t0 = work_now_ns();
+        pos = work_touch_lines(buf, pos, n);
+        work_lines_per_ns = (double)n / (work_now_ns() - t0);
+        work_sink += buf[pos * WORK_LINE];
+        free(buf);
+    }
+
+    if (work_kind != WORK_SLEEP || work_dist != DIST_ATUAL || work_factor != 1.0) {
+        printf("Trabalho: %s, distribuicao %s, fator %g", work_kind_names[work_kind], work_dist_names[work_dist], work_factor);
+        if (work_kind == WORK_SPIN) printf(" (%.2f iter/ns)", work_iters_per_ns);
+        if (work_kind == WORK_MEM) printf(" (pegada %zu KB, passo %zu linhas, %.3f linhas/ns)", work_footprint / 1024, work_stride, work_lines_per_ns);
+        if (work_dist == DIST_PARETO) printf(" (alfa %.2f)", work_pareto_alpha);
+        if (work_dist == DIST_TRACO) printf(" (%zu amostras de %s)", work_trace_n, work_trace_path);
+        printf("\n");
+    }
+}
+
+// stream espalha as threads por posições diferentes do traço.
+static void work_init(Work* w, uint64_t stream){
+    w->trace_pos = work_trace_n ? (size_t)((stream * 2654435761u) % work_trace_n) : 0;
+    w->mem = NULL;
+    w->mem_pos = 0;
+}
+
+static void work_free(Work* w){
+    free(w->mem);
+    w->mem = NULL;
+}
+
+// Sorteia a duração (ms, já com o fator) de um ponto de trabalho "lo + [0, span) ms".
+static double work_draw_ms(Work* w, Rng* rng, int lo, int span){
+    double ms;
+    double mean = lo + (span > 1 ? (span - 1) / 2.0 : 0.0);
+    switch (work_dist) {
+    case DIST_FIXO:   ms = mean; break;
+    case DIST_EXP:    ms = -mean * log(1.0 - rng_double(rng)); break;
+    case DIST_PARETO: {
+        double xm = mean * (work_pareto_alpha - 1.0) / work_pareto_alpha;
+        ms = xm / pow(1.0 - rng_double(rng), 1.0 / work_pareto_alpha);
+        break;
+    }
+    case DIST_TRACO:
+        ms = mean * work_trace[w->trace_pos];
+        if (++w->trace_pos == work_trace_n) w->trace_pos = 0;
+        break;
+    default:          ms = lo + (span > 0 ? (int)rng_below(rng, span) : 0); break;
+    }
+    return ms * work_factor;
+}
+
+// Executa ms de trabalho segundo o modelo.
+static void work_run_ms(Work* w, double ms){
+    switch (work_kind) {
+    case WORK_SPIN: work_spin_ns(ms * 1e6); break;
+    case WORK_MEM:  work_mem_ns(w, ms * 1e6); break;
+    default:        Sleep((DWORD)(ms + 0.5)); break;
+    }
+}
+
+// Com o modelo padrão é exatamente Sleep(lo + rng_below(span)).
+static void work_ms(Work* w, Rng* rng, int lo, int span){
+    work_run_ms(w, work_draw_ms(w, rng, lo, span));
+}
+
+#endif